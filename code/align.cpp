@@ -1,12 +1,15 @@
 #include "align.h"
+#include "trace.h"
 
 #include <algorithm>
+#include <climits>
+#include <cstdlib>
 #include <string>
+#include <utility>
 #include <vector>
 
-#define HORIZONTAL 0
-#define VERTICAL 1
-#define DIAGONAL 2
+dp_stats_t dp_stats{};
+kernel_config_t kernel_config{};
 
 // Substituion score for one residue against another.
 int sub_residue(char res1, char res2, align_params_t& params) {
@@ -21,16 +24,33 @@ int sub_residue(char res1, char res2, align_params_t& params) {
     }
 }
 
-// Score of inserting a gap to the *other* group, against index i of group
-int gap_score(int num_gaps, seq_group_t& group, int i, align_params_t& params) {
-    int score = 0;
+// Implements group_weight, described in align.h
+int group_weight(const seq_group_t& group) {
+    int weight = 0;
+    for (const seq_t& seq : group)
+        weight += seq.weight;
+    return weight;
+}
 
-    // Calculate score within group
-    for (size_t k = 0; k < group.size() - 1; k++) {
+// Score of every pair of sequences within column i of group, including pairs
+// of copies collapsed into one weighted row.
+static int within_score(seq_group_t& group, int i, align_params_t& params) {
+    int score = 0;
+    for (size_t k = 0; k < group.size(); k++) {
+        int weight = group[k].weight;
+        if (weight > 1)
+            score += weight * (weight - 1) / 2 * sub_residue(group[k].data[i], group[k].data[i], params);
         for (size_t m = k + 1; m < group.size(); m++) {
-            score += sub_residue(group[k].data[i], group[m].data[i], params);
+            score += weight * group[m].weight * sub_residue(group[k].data[i], group[m].data[i], params);
         }
     }
+    return score;
+}
+
+// Score of inserting a gap to the *other* group, against index i of group
+int gap_score(int num_gaps, seq_group_t& group, int i, align_params_t& params) {
+    // Calculate score within group
+    int score = within_score(group, i, params);
 
     // Calculate score within gaps (should be all 0, gap-against-gap is 0)
     // for (size_t l = 0; l < num_gaps - 1; l++) {
@@ -44,7 +64,7 @@ int gap_score(int num_gaps, seq_group_t& group, int i, align_params_t& params) {
         // for (size_t l = 0; l < num_gaps; l++) {
         //    score += sub_residue(group[k].data[i], '-');
         // }
-        score += num_gaps * sub_residue(group[k].data[i], '-', params);
+        score += num_gaps * group[k].weight * sub_residue(group[k].data[i], '-', params);
     }
 
     return score;
@@ -52,32 +72,28 @@ int gap_score(int num_gaps, seq_group_t& group, int i, align_params_t& params) {
 
 // Score calculation between two sequence groups.
 int sub_score(seq_group_t& group1, seq_group_t& group2, int i, int j, align_params_t& params){
-    int score = 0;
-
-    // Calculate score within group 1
-    for (size_t k = 0; k < group1.size() - 1; k++) {
-        for (size_t m = k + 1; m < group1.size(); m++) {
-            score += sub_residue(group1[k].data[i], group1[m].data[i], params);
-        }
-    }
-
-    // Calculate score within group 2
-    for (size_t l = 0; l < group2.size() - 1; l++) {
-        for (size_t m = l + 1; m < group2.size(); m++) {
-            score += sub_residue(group2[l].data[j], group2[m].data[j], params);
-        }
-    }
+    // Calculate score within group 1 and within group 2
+    int score = within_score(group1, i, params) + within_score(group2, j, params);
 
     // Calculate score between groups
     for(size_t k = 0; k < group1.size(); k++){
         for(size_t l = 0; l < group2.size(); l++){
-            score += sub_residue(group1[k].data[i], group2[l].data[j], params);
+            score += group1[k].weight * group2[l].weight * sub_residue(group1[k].data[i], group2[l].data[j], params);
         }
     }
 
     return score;
 }
 
+// Implements alnmt_score, described in align.h
+int alnmt_score(seq_group_t& alnmt, align_params_t& params) {
+    int score = 0;
+    size_t alnmt_len = alnmt[0].data.size();
+    for (size_t i = 0; i < alnmt_len; i++)
+        score += within_score(alnmt, i, params);
+    return score;
+}
+
 /*
  * group1 is represented along the vertical axis, and group2 is on the
  * horizontal axis.
@@ -88,25 +104,27 @@ int sub_score(seq_group_t& group1, seq_group_t& group2, int i, int j, align_para
 int forward_pass(seq_group_t& group1, seq_group_t& group2, align_params_t& params, matrix_t& score, matrix_t& backtrack){
     /**
      * S[i,j] = max {
-     *   S[i,j-1] + group1.size() * gap,
-     *   S[i-1,j] + group2.size() * gap,
+     *   S[i,j-1] + group_weight(group1) * gap,
+     *   S[i-1,j] + group_weight(group2) * gap,
      *   S[i-1,j-1] + sub'(group1, group2, i, j)
      * }
      */
 
     int num_rows = score.size();
     int num_cols = score[0].size();
+    int weight1 = group_weight(group1);
+    int weight2 = group_weight(group2);
 
     score[0][0] = 0;
 
     // Initialize first row and column with gap penalties
     for (int i = 1; i < num_rows; i++) {
-        score[i][0] = score[i-1][0] + gap_score(group2.size(), group1, i-1, params);
+        score[i][0] = score[i-1][0] + gap_score(weight2, group1, i-1, params);
         backtrack[i][0] = 1; // Vertical movement
     }
 
     for (int j = 1; j < num_cols; j++) {
-        score[0][j] = score[0][j-1] + gap_score(group1.size(), group2, j-1, params);
+        score[0][j] = score[0][j-1] + gap_score(weight1, group2, j-1, params);
         backtrack[0][j] = 0; // Horizontal movement
     }
 
@@ -114,8 +132,8 @@ int forward_pass(seq_group_t& group1, seq_group_t& group2, align_params_t& param
     for (int i = 1; i < num_rows; i++) {
         for (int j = 1; j < num_cols; j++) {
             // Calculate scores for three possible moves
-            int horizontal = score[i][j-1] + gap_score(group1.size(), group2, j-1, params);  // Gap in group1
-            int vertical = score[i-1][j] + gap_score(group2.size(), group1, i-1, params);    // Gap in group2
+            int horizontal = score[i][j-1] + gap_score(weight1, group2, j-1, params);  // Gap in group1
+            int vertical = score[i-1][j] + gap_score(weight2, group1, i-1, params);    // Gap in group2
             int diagonal = score[i-1][j-1] + sub_score(group1, group2, i-1, j-1, params);
 
             // Find the maximum score
@@ -143,6 +161,172 @@ int forward_pass(seq_group_t& group1, seq_group_t& group2, align_params_t& param
     return alnmt_score;
 }
 
+// Implements kernel_name, described in align.h
+const char *kernel_name(int kind) {
+    switch (kind) {
+        case KERNEL_PAIRWISE:
+            return "pairwise";
+        case KERNEL_CACHED:
+            return "cached";
+        case KERNEL_PROFILE_DENSE:
+            return "profile dense";
+        case KERNEL_PROFILE_SPARSE:
+            return "profile sparse";
+    }
+    return "unknown";
+}
+
+/*
+ * Weighted residue counts of every column of a group, over the residues of
+ * both groups (gaps are counted separately).
+ */
+typedef struct col_profile {
+    int alphabet_size;
+    std::vector<int> counts;  // Column-major, alphabet_size per column
+    std::vector<int> gaps;
+    std::vector<int> residues; // Weight of non-gap rows per column
+    std::vector<std::vector<std::pair<int, int>>> present; // Non-zero counts
+} col_profile_t;
+
+static void build_profile(seq_group_t& group, const std::vector<int>& residue_idx, int alphabet_size, col_profile_t& profile) {
+    int len = group[0].data.length();
+    profile.alphabet_size = alphabet_size;
+    profile.counts.assign(static_cast<size_t>(len) * alphabet_size, 0);
+    profile.gaps.assign(len, 0);
+    profile.residues.assign(len, 0);
+    profile.present.assign(len, {});
+    for (int c = 0; c < len; c++) {
+        int *col = &profile.counts[static_cast<size_t>(c) * alphabet_size];
+        for (seq_t& seq : group) {
+            char res = seq.data[c];
+            if (res == '-') {
+                profile.gaps[c] += seq.weight;
+            } else {
+                col[residue_idx[static_cast<unsigned char>(res)]] += seq.weight;
+                profile.residues[c] += seq.weight;
+            }
+        }
+        for (int a = 0; a < alphabet_size; a++) {
+            if (col[a] > 0)
+                profile.present[c].push_back({a, col[a]});
+        }
+    }
+}
+
+// Implements forward_pass_kernel, described in align.h
+int forward_pass_kernel(seq_group_t& group1, seq_group_t& group2, align_params_t& params, const kernel_config_t& config,
+                        matrix_t& score, matrix_t& backtrack) {
+    if (config.kind == KERNEL_PAIRWISE)
+        return forward_pass(group1, group2, params, score, backtrack);
+
+    int num_rows = score.size();
+    int num_cols = score[0].size();
+    int weight1 = group_weight(group1);
+    int weight2 = group_weight(group2);
+
+    // Gap and within-group scores depend only on the row (or column)
+    std::vector<int> vert_gap(num_rows, 0);
+    std::vector<int> within1(num_rows, 0);
+    for (int i = 1; i < num_rows; i++) {
+        vert_gap[i] = gap_score(weight2, group1, i-1, params);
+        within1[i] = within_score(group1, i-1, params);
+    }
+    std::vector<int> horz_gap(num_cols, 0);
+    std::vector<int> within2(num_cols, 0);
+    for (int j = 1; j < num_cols; j++) {
+        horz_gap[j] = gap_score(weight1, group2, j-1, params);
+        within2[j] = within_score(group2, j-1, params);
+    }
+
+    // Residues of both groups, numbered in order of appearance
+    std::vector<int> residue_idx(256, -1);
+    int alphabet_size = 0;
+    col_profile_t profile1{};
+    col_profile_t profile2{};
+    if (config.kind != KERNEL_CACHED) {
+        for (seq_group_t *group : {&group1, &group2}) {
+            for (seq_t& seq : *group) {
+                for (char res : seq.data) {
+                    if (res != '-' && residue_idx[static_cast<unsigned char>(res)] == -1)
+                        residue_idx[static_cast<unsigned char>(res)] = alphabet_size++;
+                }
+            }
+        }
+        build_profile(group1, residue_idx, alphabet_size, profile1);
+        build_profile(group2, residue_idx, alphabet_size, profile2);
+    }
+
+    // Score between column i of group1 and column j of group2
+    auto between = [&](int i, int j) {
+        int score = 0;
+        if (config.kind == KERNEL_CACHED) {
+            for (seq_t& seq1 : group1) {
+                for (seq_t& seq2 : group2)
+                    score += seq1.weight * seq2.weight * sub_residue(seq1.data[i], seq2.data[j], params);
+            }
+            return score;
+        }
+
+        // Pairs of equal residues, from the profiles
+        const int *col2 = &profile2.counts[static_cast<size_t>(j) * alphabet_size];
+        int same = 0;
+        if (config.kind == KERNEL_PROFILE_DENSE) {
+            const int *col1 = &profile1.counts[static_cast<size_t>(i) * alphabet_size];
+            for (int a = 0; a < alphabet_size; a++)
+                same += col1[a] * col2[a];
+        } else {
+            for (const std::pair<int, int>& count : profile1.present[i])
+                same += count.second * col2[count.first];
+        }
+        int residues1 = profile1.residues[i];
+        int residues2 = profile2.residues[j];
+        return same * params.match_reward + (residues1 * residues2 - same) * params.sub_penalty
+               + (profile1.gaps[i] * residues2 + residues1 * profile2.gaps[j]) * params.gap_penalty;
+    };
+
+    score[0][0] = 0;
+    for (int i = 1; i < num_rows; i++) {
+        score[i][0] = score[i-1][0] + vert_gap[i];
+        backtrack[i][0] = VERTICAL;
+    }
+    for (int j = 1; j < num_cols; j++) {
+        score[0][j] = score[0][j-1] + horz_gap[j];
+        backtrack[0][j] = HORIZONTAL;
+    }
+
+    // Strips of tile columns; each strip only needs the one to its left
+    int tile = config.tile > 0 ? config.tile : num_cols;
+    for (int j_lo = 1; j_lo < num_cols; j_lo += tile) {
+        int j_hi = std::min(j_lo + tile, num_cols);
+        for (int i = 1; i < num_rows; i++) {
+            std::vector<int>& prev_row = score[i-1];
+            std::vector<int>& row = score[i];
+            std::vector<int>& bt_row = backtrack[i];
+            for (int j = j_lo; j < j_hi; j++) {
+                int horizontal = row[j-1] + horz_gap[j];
+                int vertical = prev_row[j] + vert_gap[i];
+                int diagonal = prev_row[j-1] + within1[i] + within2[j] + between(i-1, j-1);
+
+                // Same order of moves as forward_pass, so ties break alike
+                int max_score = horizontal;
+                int direction = HORIZONTAL;
+                if (vertical > max_score) {
+                    max_score = vertical;
+                    direction = VERTICAL;
+                }
+                if (diagonal > max_score) {
+                    max_score = diagonal;
+                    direction = DIAGONAL;
+                }
+                row[j] = max_score;
+                bt_row[j] = direction;
+            }
+        }
+    }
+
+    return score[num_rows-1][num_cols-1];
+}
+
 // Backtracking pass. Builds gap positions based on result of forward pass
 void backward_pass(matrix_t& backtrack, gap_pos_t& gap_pos){
     int i = backtrack.size() - 1;
@@ -189,12 +373,194 @@ int align_groups(seq_group_t& group1, seq_group_t& group2, align_params_t& param
     score.resize(num_rows, std::vector<int>(num_cols, 0));
     backtrack.resize(num_rows, std::vector<int>(num_cols, 0));
 
-    int alnmt_score = forward_pass(group1, group2, params, score, backtrack);
+    TRACE_START(forward_start);
+    int alnmt_score = forward_pass_kernel(group1, group2, params, kernel_config, score, backtrack);
+    TRACE_END(TRACE_FORWARD, forward_start);
+    TRACE_START(backward_start);
     backward_pass(backtrack, gap_pos);
+    TRACE_END(TRACE_BACKWARD, backward_start);
 
+    dp_stats.cells += static_cast<long long>(num_rows) * num_cols;
+    dp_stats.full_cells += static_cast<long long>(num_rows) * num_cols;
     return alnmt_score;
 }
 
+// Implements current_gap_pos, described in align.h
+gap_pos_t current_gap_pos(seq_group_t& group1, seq_group_t& group2) {
+    gap_pos_t gap_pos{};
+    size_t alnmt_len = group1[0].data.size();
+    for (size_t c = 0; c < alnmt_len; c++) {
+        gap_option_t gap;
+        gap.group1_gap = true;
+        gap.group2_gap = true;
+        for (seq_t& seq : group1) {
+            if (seq.data[c] != '-') {
+                gap.group1_gap = false;
+                break;
+            }
+        }
+        for (seq_t& seq : group2) {
+            if (seq.data[c] != '-') {
+                gap.group2_gap = false;
+                break;
+            }
+        }
+        if (!gap.group1_gap || !gap.group2_gap)
+            gap_pos.push_back(gap);
+    }
+    return gap_pos;
+}
+
+/*
+ * Forward and backward pass restricted to columns [lo[i], hi[i]] of each row
+ * i. Moves are tried in the same order as forward_pass, so ties are broken
+ * the same way.
+ *
+ * @return Whether the best path stayed off the edges of the band (edges of
+ *         the matrix do not count).
+ */
+static bool banded_pass(seq_group_t& group1, seq_group_t& group2, align_params_t& params, const std::vector<int>& lo, const std::vector<int>& hi,
+                        int& alnmt_score, gap_pos_t& gap_pos) {
+    int num_rows = lo.size();
+    int last_col = group2[0].data.length();
+    int weight1 = group_weight(group1);
+    int weight2 = group_weight(group2);
+
+    // Gap scores depend only on the row (or column), so compute them once
+    std::vector<int> vert_gap(num_rows, 0);
+    for (int i = 1; i < num_rows; i++)
+        vert_gap[i] = gap_score(weight2, group1, i-1, params);
+    std::vector<int> horz_gap(last_col + 1, 0);
+    for (int j = 1; j <= last_col; j++)
+        horz_gap[j] = gap_score(weight1, group2, j-1, params);
+
+    // Row i holds columns lo[i] to hi[i]
+    TRACE_START(forward_start);
+    std::vector<std::vector<int>> score(num_rows);
+    std::vector<std::vector<char>> backtrack(num_rows);
+    for (int i = 0; i < num_rows; i++) {
+        score[i].assign(hi[i] - lo[i] + 1, INT_MIN);
+        backtrack[i].assign(hi[i] - lo[i] + 1, HORIZONTAL);
+        dp_stats.cells += hi[i] - lo[i] + 1;
+
+        for (int j = lo[i]; j <= hi[i]; j++) {
+            if (i == 0 && j == 0) {
+                score[0][0] = 0;
+                continue;
+            }
+
+            int max_score = INT_MIN;
+            int direction = HORIZONTAL;
+            if (j > lo[i] && score[i][j-1-lo[i]] != INT_MIN) {
+                max_score = score[i][j-1-lo[i]] + horz_gap[j];
+                direction = HORIZONTAL;
+            }
+            if (i > 0 && j >= lo[i-1] && j <= hi[i-1] && score[i-1][j-lo[i-1]] != INT_MIN) {
+                int vertical = score[i-1][j-lo[i-1]] + vert_gap[i];
+                if (max_score == INT_MIN || vertical > max_score) {
+                    max_score = vertical;
+                    direction = VERTICAL;
+                }
+            }
+            if (i > 0 && j > 0 && j-1 >= lo[i-1] && j-1 <= hi[i-1] && score[i-1][j-1-lo[i-1]] != INT_MIN) {
+                int diagonal = score[i-1][j-1-lo[i-1]] + sub_score(group1, group2, i-1, j-1, params);
+                if (max_score == INT_MIN || diagonal > max_score) {
+                    max_score = diagonal;
+                    direction = DIAGONAL;
+                }
+            }
+
+            score[i][j-lo[i]] = max_score;
+            backtrack[i][j-lo[i]] = direction;
+        }
+    }
+
+    TRACE_END(TRACE_FORWARD, forward_start);
+
+    // Backtrack from bottom-right to top-left, watching for band edges. Only
+    // a path reaching an edge regrows the band, so a better path lying wholly
+    // outside it is missed.
+    TRACE_START(backward_start);
+    int i = num_rows - 1;
+    int j = last_col;
+    alnmt_score = score[i][j-lo[i]];
+    bool inside = true;
+    gap_pos.clear();
+    while (i > 0 || j > 0) {
+        if ((j == lo[i] && lo[i] > 0) || (j == hi[i] && hi[i] < last_col))
+            inside = false;
+
+        gap_option_t gap;
+        gap.group1_gap = false;
+        gap.group2_gap = false;
+
+        int direction = backtrack[i][j-lo[i]];
+        if (i > 0 && j > 0 && direction == DIAGONAL) {
+            i--;
+            j--;
+        } else if (j > 0 && (i == 0 || direction == HORIZONTAL)) {
+            gap.group1_gap = true;
+            j--;
+        } else {
+            gap.group2_gap = true;
+            i--;
+        }
+        gap_pos.push_back(gap);
+    }
+    std::reverse(gap_pos.begin(), gap_pos.end());
+    TRACE_END(TRACE_BACKWARD, backward_start);
+
+    return inside;
+}
+
+// Implements align_groups_banded, described in align.h
+int align_groups_banded(seq_group_t& group1, seq_group_t& group2, const gap_pos_t& prev_path, align_params_t& params, gap_pos_t& gap_pos) {
+    int len1 = group1[0].data.length();
+    int len2 = group2[0].data.length();
+
+    // Columns the previous path visits in each row
+    std::vector<int> path_lo(len1 + 1, len2);
+    std::vector<int> path_hi(len1 + 1, 0);
+    int i = 0;
+    int j = 0;
+    path_lo[0] = 0;
+    for (const gap_option_t& gap : prev_path) {
+        if (!gap.group1_gap && i < len1)
+            i++;
+        if (!gap.group2_gap && j < len2)
+            j++;
+        path_lo[i] = std::min(path_lo[i], j);
+        path_hi[i] = std::max(path_hi[i], j);
+    }
+
+    // The previous path does not describe these groups
+    if (i != len1 || j != len2) {
+        dp_stats.full_fallbacks++;
+        return align_groups(group1, group2, params, gap_pos);
+    }
+
+    int width = std::max(BAND_MIN_WIDTH, std::abs(len1 - len2));
+    std::vector<int> lo(len1 + 1);
+    std::vector<int> hi(len1 + 1);
+    while (width < std::max(len1, len2)) {
+        for (int r = 0; r <= len1; r++) {
+            lo[r] = std::max(0, path_lo[r] - width);
+            hi[r] = std::min(len2, path_hi[r] + width);
+        }
+
+        int alnmt_score;
+        if (banded_pass(group1, group2, params, lo, hi, alnmt_score, gap_pos)) {
+            dp_stats.full_cells += static_cast<long long>(len1 + 1) * (len2 + 1);
+            return alnmt_score;
+        }
+        dp_stats.band_regrows++;
+        width *= 2;
+    }
+
+    dp_stats.full_fallbacks++;
+    return align_groups(group1, group2, params, gap_pos);
+}
+
 // Implements update_alnmt, described in align.h
 seq_group_t update_alnmt(seq_group_t& group1, seq_group_t& group2, gap_pos_t& gap_pos) {
     int num_seqs = group1.size() + group2.size();
@@ -207,6 +573,10 @@ seq_group_t update_alnmt(seq_group_t& group1, seq_group_t& group2, gap_pos_t& ga
         seq_i.data = "";
         new_alnmt.push_back(seq_i);
     }
+    for (seq_t& group1_seq : group1)
+        new_alnmt[group1_seq.id].weight = group1_seq.weight;
+    for (seq_t& group2_seq : group2)
+        new_alnmt[group2_seq.id].weight = group2_seq.weight;
 
     // Build new alignment
     int group1_pos = 0;
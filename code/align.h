@@ -11,11 +11,26 @@
 #include <vector>
 
 /**
- * Data structure to represent sequences.
+ * Backtrack directions stored by the forward pass.
+ */
+#define HORIZONTAL 0
+#define VERTICAL 1
+#define DIAGONAL 2
+
+/**
+ * Smallest band half-width tried by align_groups_banded.
+ */
+#define BAND_MIN_WIDTH 8
+
+/**
+ * Data structure to represent sequences. A row may stand for several
+ * identical input sequences, counted by weight; scores count every pair of
+ * the sequences a group stands for.
  */
 typedef struct seq {
     int id;
     std::string data;
+    int weight = 1;
 } seq_t;
 typedef std::vector<seq_t> seq_group_t;
 
@@ -24,6 +39,51 @@ typedef std::vector<seq_t> seq_group_t;
  */
 typedef std::vector<std::vector<int>> matrix_t;
 
+/**
+ * Counts of dynamic programming work done by this processor. full_cells is
+ * what full DP would have computed for the same alignments.
+ */
+typedef struct dp_stats {
+    long long cells = 0;
+    long long full_cells = 0;
+    int band_regrows = 0;   // Bands widened because the path touched an edge
+    int full_fallbacks = 0; // Banded alignments that fell back to full DP
+    int anchored_alnmts = 0; // Alignments split at anchors (see anchor.h)
+    long long anchor_cols = 0;
+    int anchor_checks = 0;  // Anchored alignments also computed with full DP
+    long long anchor_loss = 0; // Total score full DP found above them
+    int anchor_worse = 0;   // Anchored alignments scoring below full DP
+} dp_stats_t;
+extern dp_stats_t dp_stats;
+
+/**
+ * Forward pass kernels of align_groups. All compute the same scores and
+ * paths. KERNEL_PAIRWISE rescores every pair of sequences at every cell.
+ * KERNEL_CACHED computes gap and within-group scores once per row and
+ * column. The profile kernels also score between groups from per-column
+ * residue counts: dense dots every residue of the alphabet, and sparse walks
+ * only the residues present in group1's column.
+ */
+#define KERNEL_PAIRWISE 0
+#define KERNEL_CACHED 1
+#define KERNEL_PROFILE_DENSE 2
+#define KERNEL_PROFILE_SPARSE 3
+
+/**
+ * Kernel configuration of align_groups. A tile of T > 0 fills the DP matrix
+ * in strips of T columns, rather than a whole row at a time.
+ */
+typedef struct kernel_config {
+    int kind = KERNEL_PAIRWISE;
+    int tile = 0;
+} kernel_config_t;
+extern kernel_config_t kernel_config;
+
+/**
+ * Name of a kernel, for output.
+ */
+const char *kernel_name(int kind);
+
 /**
  * Represents aligment parameters
  */
@@ -44,6 +104,48 @@ typedef struct gap_option {
 } gap_option_t;
 typedef std::vector<gap_option_t> gap_pos_t;
 
+/**
+ * Number of sequences a group stands for (the sum of its weights).
+ */
+int group_weight(const seq_group_t& group);
+
+/**
+ * Score of inserting num_gaps gaps (one per sequence of the *other* group,
+ * see group_weight) against column i of group.
+ */
+int gap_score(int num_gaps, seq_group_t& group, int i, align_params_t& params);
+
+/**
+ * Score of aligning column i of group1 against column j of group2.
+ */
+int sub_score(seq_group_t& group1, seq_group_t& group2, int i, int j, align_params_t& params);
+
+/**
+ * Sum-of-pairs score of an alignment. Equal to the score align_groups returns
+ * for any partition of the alignment that leaves it unchanged.
+ */
+int alnmt_score(seq_group_t& alnmt, align_params_t& params);
+
+/**
+ * Forward pass of align_groups: fills the score and backtrack matrices, which
+ * must be sized (len1 + 1) x (len2 + 1).
+ *
+ * @return Score of the resulting alignment.
+ */
+int forward_pass(seq_group_t& group1, seq_group_t& group2, align_params_t& params, matrix_t& score, matrix_t& backtrack);
+
+/**
+ * Like forward_pass, with the given kernel configuration.
+ */
+int forward_pass_kernel(seq_group_t& group1, seq_group_t& group2, align_params_t& params, const kernel_config_t& config,
+                        matrix_t& score, matrix_t& backtrack);
+
+/**
+ * Backward pass of align_groups: follows the backtrack matrix from the
+ * bottom-right corner, saving the new gaps in gap_pos.
+ */
+void backward_pass(matrix_t& backtrack, gap_pos_t& gap_pos);
+
 /**
  * Aligns two sequence groups, saving the new gaps in gap_pos.
  *
@@ -54,6 +156,25 @@ typedef std::vector<gap_option_t> gap_pos_t;
  */
 int align_groups(seq_group_t& group1, seq_group_t& group2, align_params_t& params, gap_pos_t& gap_pos);
 
+/**
+ * Gap positions that reproduce the current alignment of group1 against
+ * group2, before their global gaps are removed. Columns that are gaps in both
+ * groups are skipped.
+ */
+gap_pos_t current_gap_pos(seq_group_t& group1, seq_group_t& group2);
+
+/**
+ * Aligns two sequence groups like align_groups, but only computes cells
+ * within a band around prev_path (see current_gap_pos). The band's half-width
+ * starts at the larger of BAND_MIN_WIDTH and the difference in lengths, and
+ * doubles whenever the best path in the band touches its edge, until full DP
+ * is used. This is a heuristic: a better path wholly outside the band is
+ * missed, so the score can be below that of align_groups.
+ *
+ * @return Score of the resulting alignment.
+ */
+int align_groups_banded(seq_group_t& group1, seq_group_t& group2, const gap_pos_t& prev_path, align_params_t& params, gap_pos_t& gap_pos);
+
 /**
  * Updates an alignment with new gap positons. group1 and group2 represent a partition of the alignment.
  * @param group1
@@ -0,0 +1,186 @@
+#include "align_team.h"
+#include "align.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <mpi.h>
+
+#define TAG_BOUNDARY 0
+#define TAG_TRACEBACK 1
+
+// Implements align_groups_team, described in align_team.h
+int align_groups_team(seq_group_t& group1, seq_group_t& group2, align_params_t& params, gap_pos_t& gap_pos, MPI_Comm team_comm) {
+    int team_rank;
+    int team_size;
+    MPI_Comm_rank(team_comm, &team_rank);
+    MPI_Comm_size(team_comm, &team_size);
+
+    int num_rows = group1[0].data.length() + 1;
+    int num_cols = group2[0].data.length() + 1;
+
+    // Not enough columns to give every processor a block; each computes the
+    // whole alignment instead.
+    if (team_size == 1 || num_cols < team_size)
+        return align_groups(group1, group2, params, gap_pos);
+
+    // This processor owns columns [col_lo, col_hi) of the DP matrix
+    int col_lo = (num_cols * team_rank) / team_size;
+    int col_hi = (num_cols * (team_rank + 1)) / team_size;
+    int width = col_hi - col_lo;
+    dp_stats.cells += static_cast<long long>(num_rows) * width;
+    if (team_rank == 0)
+        dp_stats.full_cells += static_cast<long long>(num_rows) * num_cols;
+
+    // Gap scores depend only on the row (or column), so compute them once
+    std::vector<int> vert_gap(num_rows, 0);
+    for (int i = 1; i < num_rows; i++)
+        vert_gap[i] = gap_score(group_weight(group2), group1, i-1, params);
+    std::vector<int> horz_gap(width, 0);
+    for (int j = std::max(col_lo, 1); j < col_hi; j++)
+        horz_gap[j - col_lo] = gap_score(group_weight(group1), group2, j-1, params);
+
+    // Only two rows of scores are kept. Index 0 holds column col_lo - 1,
+    // received from the left neighbour; index k holds column col_lo + k - 1.
+    std::vector<int> prev(width + 1, 0);
+    std::vector<int> cur(width + 1, 0);
+    std::vector<char> backtrack(static_cast<size_t>(num_rows) * width, HORIZONTAL);
+
+    std::vector<int> left_col(TEAM_ROW_BLOCK, 0);
+    std::vector<int> right_col(TEAM_ROW_BLOCK, 0);
+
+    // Forward pass, pipelined over blocks of rows
+    TRACE_START(forward_start);
+    for (int row_lo = 0; row_lo < num_rows; row_lo += TEAM_ROW_BLOCK) {
+        int row_hi = std::min(row_lo + TEAM_ROW_BLOCK, num_rows);
+        int block_rows = row_hi - row_lo;
+
+        if (team_rank > 0)
+            MPI_Recv(left_col.data(), block_rows, MPI_INT, team_rank - 1, TAG_BOUNDARY, team_comm, MPI_STATUS_IGNORE);
+
+        for (int i = row_lo; i < row_hi; i++) {
+            cur[0] = left_col[i - row_lo];
+            char *bt_row = &backtrack[static_cast<size_t>(i) * width];
+
+            for (int k = 1; k <= width; k++) {
+                int j = col_lo + k - 1;
+
+                if (i == 0 && j == 0) {
+                    cur[k] = 0;
+                    bt_row[k-1] = HORIZONTAL;
+                } else if (i == 0) {
+                    cur[k] = cur[k-1] + horz_gap[k-1];
+                    bt_row[k-1] = HORIZONTAL;
+                } else if (j == 0) {
+                    cur[k] = prev[k] + vert_gap[i];
+                    bt_row[k-1] = VERTICAL;
+                } else {
+                    int horizontal = cur[k-1] + horz_gap[k-1];  // Gap in group1
+                    int vertical = prev[k] + vert_gap[i];       // Gap in group2
+                    int diagonal = prev[k-1] + sub_score(group1, group2, i-1, j-1, params);
+
+                    int maxScore = horizontal;
+                    int direction = HORIZONTAL;
+
+                    if (vertical > maxScore) {
+                        maxScore = vertical;
+                        direction = VERTICAL;
+                    }
+
+                    if (diagonal > maxScore) {
+                        maxScore = diagonal;
+                        direction = DIAGONAL;
+                    }
+
+                    cur[k] = maxScore;
+                    bt_row[k-1] = direction;
+                }
+            }
+
+            right_col[i - row_lo] = cur[width];
+            std::swap(prev, cur);
+        }
+
+        if (team_rank < team_size - 1)
+            MPI_Send(right_col.data(), block_rows, MPI_INT, team_rank + 1, TAG_BOUNDARY, team_comm);
+    }
+
+    // Bottom-right score is held by the last processor
+    int alnmt_score = prev[width];
+    MPI_Bcast(&alnmt_score, 1, MPI_INT, team_size - 1, team_comm);
+    TRACE_END(TRACE_FORWARD, forward_start);
+
+    // Backward pass. The path enters from the right neighbour (or starts at
+    // the bottom-right corner), and leaves to the left neighbour.
+    TRACE_START(backward_start);
+    int i;
+    int j;
+    if (team_rank == team_size - 1) {
+        i = num_rows - 1;
+        j = num_cols - 1;
+    } else {
+        MPI_Recv(&i, 1, MPI_INT, team_rank + 1, TAG_TRACEBACK, team_comm, MPI_STATUS_IGNORE);
+        j = col_hi - 1;
+    }
+
+    gap_pos_t block_gap_pos{};
+    while ((i > 0 || j > 0) && j >= col_lo) {
+        int direction = backtrack[static_cast<size_t>(i) * width + (j - col_lo)];
+        gap_option_t gap;
+        gap.group1_gap = false;
+        gap.group2_gap = false;
+
+        if (i > 0 && j > 0 && direction == DIAGONAL) {
+            i--;
+            j--;
+        } else if (j > 0 && (i == 0 || direction == HORIZONTAL)) {
+            gap.group1_gap = true;
+            j--;
+        } else if (i > 0 && (j == 0 || direction == VERTICAL)) {
+            gap.group2_gap = true;
+            i--;
+        }
+
+        block_gap_pos.push_back(gap);
+    }
+
+    if (team_rank > 0)
+        MPI_Send(&i, 1, MPI_INT, team_rank - 1, TAG_TRACEBACK, team_comm);
+
+    std::reverse(block_gap_pos.begin(), block_gap_pos.end());
+
+    // Gather every block's gap positions. Blocks are in processor order,
+    // which is also left-to-right alignment order.
+    int block_len = block_gap_pos.size();
+    std::vector<int> block_lens(team_size, 0);
+    MPI_Allgather(&block_len, 1, MPI_INT, block_lens.data(), 1, MPI_INT, team_comm);
+
+    std::vector<int> counts(team_size, 0);
+    std::vector<int> displs(team_size, 0);
+    int total_bytes = 0;
+    for (int r = 0; r < team_size; r++) {
+        counts[r] = 2 * block_lens[r];
+        displs[r] = total_bytes;
+        total_bytes += counts[r];
+    }
+
+    std::vector<char> block_bytes(2 * block_len, 0);
+    for (int k = 0; k < block_len; k++) {
+        block_bytes[2*k] = block_gap_pos[k].group1_gap ? 1 : 0;
+        block_bytes[2*k+1] = block_gap_pos[k].group2_gap ? 1 : 0;
+    }
+    std::vector<char> all_bytes(total_bytes, 0);
+    MPI_Allgatherv(block_bytes.data(), 2 * block_len, MPI_CHAR, all_bytes.data(), counts.data(), displs.data(), MPI_CHAR, team_comm);
+
+    gap_pos.clear();
+    for (int k = 0; k < total_bytes / 2; k++) {
+        gap_option_t gap;
+        gap.group1_gap = all_bytes[2*k] == 1;
+        gap.group2_gap = all_bytes[2*k+1] == 1;
+        gap_pos.push_back(gap);
+    }
+    TRACE_END(TRACE_BACKWARD, backward_start);
+
+    return alnmt_score;
+}
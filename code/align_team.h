@@ -0,0 +1,39 @@
+/** @file align_team.h
+ *  @brief Distributed alignment of two groups across a team of processors.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#ifndef __ALIGN_TEAM_H__
+#define __ALIGN_TEAM_H__
+
+#include "align.h"
+
+#include <mpi.h>
+
+/**
+ * Number of rows computed before a block's right boundary column is sent on
+ * to the next processor in the team.
+ */
+#define TEAM_ROW_BLOCK 64
+
+/**
+ * Aligns two sequence groups cooperatively across every processor of
+ * team_comm. Must be called by all processors of the team with identical
+ * groups.
+ *
+ * The columns of the DP matrix (group2) are split into contiguous blocks, one
+ * per processor. Rows are computed in blocks of TEAM_ROW_BLOCK, with the
+ * boundary column of each block pipelined to the right neighbour. The
+ * traceback is handed back leftwards, and the gap positions are gathered on
+ * every processor of the team.
+ *
+ * @param group1
+ * @param group2
+ * @param gap_pos
+ * @param team_comm
+ * @return Score of the resulting alignment, on every processor of the team.
+ */
+int align_groups_team(seq_group_t& group1, seq_group_t& group2, align_params_t& params, gap_pos_t& gap_pos, MPI_Comm team_comm);
+
+#endif
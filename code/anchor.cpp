@@ -0,0 +1,159 @@
+#include "anchor.h"
+#include "align.h"
+#include "bm_utils.h"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Implements group_consensus, described in anchor.h
+std::string group_consensus(const seq_group_t& group) {
+    size_t alnmt_len = group[0].data.size();
+    std::string consensus(alnmt_len, '-');
+    std::vector<int> counts(256, 0);
+    for (size_t c = 0; c < alnmt_len; c++) {
+        std::fill(counts.begin(), counts.end(), 0);
+        int best = 0;
+        for (const seq_t& seq : group) {
+            unsigned char res = seq.data[c];
+            counts[res] += seq.weight;
+            if (counts[res] > best || (counts[res] == best && res == '-')) {
+                best = counts[res];
+                consensus[c] = res;
+            }
+        }
+    }
+    return consensus;
+}
+
+// Start of every k-mer without gaps that occurs exactly once, by k-mer.
+static std::unordered_map<std::string_view, int> unique_kmers(const std::string& consensus) {
+    std::unordered_map<std::string_view, int> kmers{};
+    if (consensus.size() < ANCHOR_KMER_LEN)
+        return kmers;
+
+    std::string_view view(consensus);
+    for (size_t i = 0; i + ANCHOR_KMER_LEN <= consensus.size(); i++) {
+        std::string_view kmer = view.substr(i, ANCHOR_KMER_LEN);
+        if (kmer.find('-') != std::string_view::npos)
+            continue;
+        auto found = kmers.find(kmer);
+        if (found == kmers.end())
+            kmers.emplace(kmer, i);
+        else
+            found->second = -1; // Repeated
+    }
+    return kmers;
+}
+
+// Implements find_anchors, described in anchor.h
+std::vector<anchor_t> find_anchors(const std::string& consensus1, const std::string& consensus2) {
+    std::unordered_map<std::string_view, int> kmers1 = unique_kmers(consensus1);
+    std::unordered_map<std::string_view, int> kmers2 = unique_kmers(consensus2);
+
+    std::vector<anchor_t> matches{};
+    for (auto& [kmer, i] : kmers1) {
+        auto found = kmers2.find(kmer);
+        if (i >= 0 && found != kmers2.end() && found->second >= 0)
+            matches.push_back(anchor_t{i, found->second, ANCHOR_KMER_LEN});
+    }
+
+    // Merge overlapping matches on the same diagonal
+    std::sort(matches.begin(), matches.end(), [](const anchor_t& a, const anchor_t& b) {
+        return a.i - a.j != b.i - b.j ? a.i - a.j < b.i - b.j : a.i < b.i;
+    });
+    std::vector<anchor_t> merged{};
+    for (const anchor_t& match : matches) {
+        if (!merged.empty()) {
+            anchor_t& last = merged.back();
+            if (last.i - last.j == match.i - match.j && match.i <= last.i + last.len) {
+                last.len = std::max(last.len, match.i + match.len - last.i);
+                continue;
+            }
+        }
+        merged.push_back(match);
+    }
+
+    // Chain co-linear anchors, maximizing the columns covered
+    std::sort(merged.begin(), merged.end(), [](const anchor_t& a, const anchor_t& b) { return a.i != b.i ? a.i < b.i : a.j < b.j; });
+    int num_anchors = merged.size();
+    std::vector<int> cover(num_anchors);
+    std::vector<int> prev(num_anchors, -1);
+    int best = -1;
+    for (int a = 0; a < num_anchors; a++) {
+        cover[a] = merged[a].len;
+        for (int b = 0; b < a; b++) {
+            if (merged[b].i + merged[b].len <= merged[a].i && merged[b].j + merged[b].len <= merged[a].j
+                && cover[b] + merged[a].len > cover[a]) {
+                cover[a] = cover[b] + merged[a].len;
+                prev[a] = b;
+            }
+        }
+        if (best == -1 || cover[a] > cover[best])
+            best = a;
+    }
+
+    std::vector<anchor_t> chain{};
+    for (int a = best; a != -1; a = prev[a])
+        chain.push_back(merged[a]);
+    std::reverse(chain.begin(), chain.end());
+    return chain;
+}
+
+// Implements align_groups_anchored, described in anchor.h
+int align_groups_anchored(seq_group_t& group1, seq_group_t& group2, align_params_t& params, gap_pos_t& gap_pos) {
+    int len1 = group1[0].data.size();
+    int len2 = group2[0].data.size();
+    std::vector<anchor_t> anchors = find_anchors(group_consensus(group1), group_consensus(group2));
+    if (anchors.empty())
+        return align_groups(group1, group2, params, gap_pos);
+
+    // Segments count their own cells; the full matrix is what full DP would
+    // have computed
+    long long full_cells = dp_stats.full_cells;
+
+    // The end of the groups acts as a final, empty anchor
+    anchors.push_back(anchor_t{len1, len2, 0});
+
+    int score = 0;
+    int i = 0;
+    int j = 0;
+    gap_pos.clear();
+    for (const anchor_t& anchor : anchors) {
+        if (anchor.i > i || anchor.j > j) {
+            seq_group_t seg1 = slice_group(group1, i, anchor.i);
+            seq_group_t seg2 = slice_group(group2, j, anchor.j);
+            gap_pos_t seg_gap_pos{};
+            score += align_groups(seg1, seg2, params, seg_gap_pos);
+            gap_pos.insert(gap_pos.end(), seg_gap_pos.begin(), seg_gap_pos.end());
+        }
+
+        for (int k = 0; k < anchor.len; k++) {
+            score += sub_score(group1, group2, anchor.i + k, anchor.j + k, params);
+            gap_pos.push_back(gap_option_t{false, false});
+        }
+        dp_stats.anchor_cols += anchor.len;
+
+        i = anchor.i + anchor.len;
+        j = anchor.j + anchor.len;
+    }
+
+    dp_stats.full_cells = full_cells + static_cast<long long>(len1 + 1) * (len2 + 1);
+    dp_stats.anchored_alnmts++;
+    return score;
+}
+
+// Implements check_anchored, described in anchor.h
+void check_anchored(seq_group_t& group1, seq_group_t& group2, align_params_t& params, int anchored_score) {
+    dp_stats_t saved = dp_stats;
+    gap_pos_t full_gap_pos{};
+    int full_score = align_groups(group1, group2, params, full_gap_pos);
+    dp_stats = saved;
+
+    dp_stats.anchor_checks++;
+    dp_stats.anchor_loss += full_score - anchored_score;
+    if (anchored_score < full_score)
+        dp_stats.anchor_worse++;
+}
@@ -0,0 +1,61 @@
+/** @file anchor.h
+ *  @brief Anchor-seeded alignment of two groups, for very long sequences.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#ifndef __ANCHOR_H__
+#define __ANCHOR_H__
+
+#include "align.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Length of the exact k-mer matches anchors are seeded from.
+ */
+#define ANCHOR_KMER_LEN 6
+
+/**
+ * An exact match of len columns between the consensus of group1 (starting at
+ * column i) and the consensus of group2 (starting at column j).
+ */
+typedef struct anchor {
+    int i;
+    int j;
+    int len;
+} anchor_t;
+
+/**
+ * Consensus of a group: the most common character of each column, counting
+ * sequences by weight (a gap if gaps are most common).
+ */
+std::string group_consensus(const seq_group_t& group);
+
+/**
+ * Finds anchors between two consensus sequences. k-mers occurring exactly
+ * once in each are matched, matches on the same diagonal are merged, and the
+ * set of non-overlapping, co-linear matches covering the most columns is
+ * returned, ordered by position.
+ */
+std::vector<anchor_t> find_anchors(const std::string& consensus1, const std::string& consensus2);
+
+/**
+ * Aligns two sequence groups like align_groups, but keeps the columns of
+ * anchors between their consensus sequences aligned, and only runs
+ * align_groups on the segments between anchors. The gap positions cover the
+ * whole groups, so they can be passed to update_alnmt.
+ *
+ * @return Score of the resulting alignment.
+ */
+int align_groups_anchored(seq_group_t& group1, seq_group_t& group2, align_params_t& params, gap_pos_t& gap_pos);
+
+/**
+ * Quality check for align_groups_anchored: realigns the groups with full DP
+ * and records in dp_stats how far anchored_score fell below it. The full DP
+ * cells are not counted.
+ */
+void check_anchored(seq_group_t& group1, seq_group_t& group2, align_params_t& params, int anchored_score);
+
+#endif
@@ -0,0 +1,159 @@
+#include "autotune.h"
+#include "align.h"
+#include "bm_utils.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+// Every kernel at a few tile widths
+static const kernel_config_t candidates[] = {
+    {KERNEL_PAIRWISE, 0},
+    {KERNEL_CACHED, 0},
+    {KERNEL_PROFILE_DENSE, 0},
+    {KERNEL_PROFILE_DENSE, 64},
+    {KERNEL_PROFILE_DENSE, 256},
+    {KERNEL_PROFILE_SPARSE, 0},
+    {KERNEL_PROFILE_SPARSE, 64},
+    {KERNEL_PROFILE_SPARSE, 256},
+};
+
+// Implements default_autotune_cache, described in autotune.h
+std::string default_autotune_cache() {
+    const char *home = getenv("HOME");
+    if (home == NULL)
+        return ".bm_autotune";
+    std::string cache_dir = std::string(home) + "/.cache";
+    mkdir(cache_dir.c_str(), 0755);
+    return cache_dir + "/bm_autotune";
+}
+
+// CPU model and number of hardware threads.
+static std::string cpu_signature() {
+    std::string model = "unknown cpu";
+    std::ifstream fin("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(fin, line)) {
+        if (line.rfind("model name", 0) == 0) {
+            model = line.substr(line.find(':') + 2);
+            break;
+        }
+    }
+    return model + " x" + std::to_string(std::thread::hardware_concurrency());
+}
+
+// Smallest power of two at least n.
+static int pow2_bucket(int n) {
+    int bucket = 1;
+    while (bucket < n)
+        bucket *= 2;
+    return bucket;
+}
+
+// Number of sequences and alignment length (rounded up to powers of two),
+// alphabet, and partition family.
+static std::string shape_signature(seq_group_t& alnmt, partn_family_t& family) {
+    std::vector<bool> seen(256, false);
+    int alphabet_size = 0;
+    for (seq_t& seq : alnmt) {
+        for (char res : seq.data) {
+            if (res != '-' && !seen[static_cast<unsigned char>(res)]) {
+                seen[static_cast<unsigned char>(res)] = true;
+                alphabet_size++;
+            }
+        }
+    }
+    const char *alphabet = alphabet_size <= 4 ? "dna" : (alphabet_size <= 25 ? "protein" : "other");
+    return "n" + std::to_string(pow2_bucket(alnmt.size())) + " l" + std::to_string(pow2_bucket(alnmt[0].data.size()))
+           + " " + alphabet + " " + partn_family_name(family.kind);
+}
+
+// Looks up a key in the cache.
+static bool read_cache(const std::string& filename, const std::string& key, kernel_config_t& config) {
+    std::ifstream fin(filename);
+    std::string line;
+    bool found = false;
+    while (std::getline(fin, line)) {
+        // key, kind and tile, separated by tabs; later entries win
+        size_t tab1 = line.find('\t');
+        size_t tab2 = line.find('\t', tab1 + 1);
+        if (tab1 == std::string::npos || tab2 == std::string::npos || line.substr(0, tab1) != key)
+            continue;
+        config.kind = atoi(line.c_str() + tab1 + 1);
+        config.tile = atoi(line.c_str() + tab2 + 1);
+        found = true;
+    }
+    return found;
+}
+
+// Whether two paths are the same.
+static bool same_path(const gap_pos_t& path1, const gap_pos_t& path2) {
+    if (path1.size() != path2.size())
+        return false;
+    for (size_t k = 0; k < path1.size(); k++) {
+        if (path1[k].group1_gap != path2[k].group1_gap || path1[k].group2_gap != path2[k].group2_gap)
+            return false;
+    }
+    return true;
+}
+
+// Implements autotune, described in autotune.h
+autotune_result_t autotune(seq_group_t& alnmt, partn_family_t& family, align_params_t& params, const std::string& cache_filename) {
+    const auto start = CLOCK_NOW;
+    autotune_result_t result{};
+    result.key = cpu_signature() + ", " + shape_signature(alnmt, family);
+    result.cached = read_cache(cache_filename, result.key, result.config);
+    if (result.cached) {
+        result.tune_sec = TIME_SEC(start, CLOCK_NOW);
+        return result;
+    }
+
+    // A representative partition of the actual input
+    seq_group_t group1{};
+    seq_group_t group2{};
+    build_partn(alnmt, 0, family, group1, group2);
+    remove_glbl_gaps(group1);
+    remove_glbl_gaps(group2);
+    int num_rows = group1[0].data.length() + 1;
+    int num_cols = group2[0].data.length() + 1;
+    matrix_t score(num_rows, std::vector<int>(num_cols, 0));
+    matrix_t backtrack(num_rows, std::vector<int>(num_cols, 0));
+
+    kernel_config_t reference{};
+    int ref_score = forward_pass_kernel(group1, group2, params, reference, score, backtrack);
+    gap_pos_t ref_path{};
+    backward_pass(backtrack, ref_path);
+
+    double best_sec = 0.0;
+    for (const kernel_config_t& config : candidates) {
+        double config_sec = 0.0;
+        bool valid = true;
+        for (int run = 0; run < AUTOTUNE_RUNS && valid; run++) {
+            const auto run_start = CLOCK_NOW;
+            int cur_score = forward_pass_kernel(group1, group2, params, config, score, backtrack);
+            gap_pos_t path{};
+            backward_pass(backtrack, path);
+            double sec = TIME_SEC(run_start, CLOCK_NOW);
+
+            valid = cur_score == ref_score && same_path(path, ref_path);
+            if (run == 0 || sec < config_sec)
+                config_sec = sec;
+        }
+
+        if (valid && (config.kind == KERNEL_PAIRWISE || config_sec < best_sec)) {
+            best_sec = config_sec;
+            result.config = config;
+        }
+    }
+
+    std::ofstream fout(cache_filename, std::ios::app);
+    fout << result.key << "\t" << result.config.kind << "\t" << result.config.tile << "\n";
+
+    result.tune_sec = TIME_SEC(start, CLOCK_NOW);
+    return result;
+}
@@ -0,0 +1,45 @@
+/** @file autotune.h
+ *  @brief Startup autotuning of the align_groups kernel configuration, with
+ *         results cached on disk per CPU and input shape.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#ifndef __AUTOTUNE_H__
+#define __AUTOTUNE_H__
+
+#include "align.h"
+#include "bm_utils.h"
+
+#include <string>
+
+/**
+ * Timed runs of each candidate; the fastest run counts.
+ */
+#define AUTOTUNE_RUNS 2
+
+/**
+ * Result of autotuning.
+ */
+typedef struct autotune_result {
+    kernel_config_t config;
+    bool cached;      // Whether the configuration came from the cache
+    double tune_sec;  // Time spent tuning (or reading the cache)
+    std::string key;  // CPU and input-shape signature
+} autotune_result_t;
+
+/**
+ * Default cache file: ~/.cache/bm_autotune, or .bm_autotune if HOME is not
+ * set.
+ */
+std::string default_autotune_cache();
+
+/**
+ * Chooses the fastest kernel configuration for aligning partitions of an
+ * alignment. Candidates are timed on the alignment's first partition in the
+ * family, and must reproduce the pairwise kernel's score and path. The
+ * choice is looked up in, and otherwise appended to, cache_filename.
+ */
+autotune_result_t autotune(seq_group_t& alnmt, partn_family_t& family, align_params_t& params, const std::string& cache_filename);
+
+#endif
@@ -0,0 +1,65 @@
+#include "batch.h"
+#include "parse_fasta.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+bool read_manifest(const std::string& filename, std::vector<batch_job_t>& jobs) {
+    std::ifstream fin(filename);
+    if (!fin)
+        return false;
+
+    std::string line{};
+    while (std::getline(fin, line)) {
+        std::istringstream fields(line);
+        batch_job_t job{};
+        if (!(fields >> job.input_filename) || job.input_filename[0] == '#')
+            continue;
+        if (!(fields >> job.output_filename))
+            return false;
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+bool estimate_costs(std::vector<batch_job_t>& jobs) {
+    for (batch_job_t& job : jobs) {
+        // map_fasta exits on a missing file, so check first
+        struct stat file_stat;
+        if (stat(job.input_filename.c_str(), &file_stat) != 0) {
+            std::cerr << "Unable to open file: " << job.input_filename << ".\n";
+            return false;
+        }
+
+        fasta_map_t fasta_map{};
+        map_fasta(job.input_filename, 1, fasta_map);
+        job.num_seqs = fasta_map.recs.size();
+        job.max_len = 0;
+        for (const fasta_rec_t& rec : fasta_map.recs)
+            job.max_len = std::max(job.max_len, static_cast<int>(rec.seq.size()));
+        job.cost = static_cast<double>(job.num_seqs) * job.max_len;
+        unmap_fasta(fasta_map);
+    }
+    return true;
+}
+
+std::vector<int> size_groups(const std::vector<batch_job_t>& jobs, int num_units) {
+    int num_groups = std::min(num_units, static_cast<int>(jobs.size()));
+    std::vector<int> sizes(num_groups, 1);
+
+    for (int unit = num_groups; unit < num_units; unit++) {
+        int neediest = 0;
+        for (int k = 1; k < num_groups; k++) {
+            if (jobs[k].cost * sizes[neediest] > jobs[neediest].cost * sizes[k])
+                neediest = k;
+        }
+        sizes[neediest]++;
+    }
+    return sizes;
+}
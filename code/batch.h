@@ -0,0 +1,51 @@
+/** @file batch.h
+ *  Manifests and scheduling for aligning many FASTA families in one run of
+ *  parallel Berger-Munson.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <string>
+#include <vector>
+
+/**
+ * Represents one family of a batch: an input FASTA file, the file its
+ * alignment is written to, and its estimated cost.
+ */
+typedef struct batch_job {
+    std::string input_filename;
+    std::string output_filename;
+    int num_seqs = 0;
+    int max_len = 0;
+    double cost = 0.0; // num_seqs * max_len
+} batch_job_t;
+
+/**
+ * Reads a manifest with one "input_filename output_filename" pair per line.
+ * Blank lines and lines starting with '#' are skipped.
+ *
+ * @return Whether the manifest could be read and every line was a pair.
+ */
+bool read_manifest(const std::string& filename, std::vector<batch_job_t>& jobs);
+
+/**
+ * Fills in the cost of every job by scanning its input file.
+ *
+ * @return Whether every input file could be opened.
+ */
+bool estimate_costs(std::vector<batch_job_t>& jobs);
+
+/**
+ * Splits num_units units of processors into one group per job, for the
+ * min(num_units, jobs.size()) costliest jobs. Every group gets one unit, and
+ * the rest go to the groups with the most cost per unit. jobs must be sorted
+ * by decreasing cost.
+ *
+ * @return The number of units of each group.
+ */
+std::vector<int> size_groups(const std::vector<batch_job_t>& jobs, int num_units);
+
+#endif
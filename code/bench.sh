@@ -18,6 +18,10 @@ for input_file in "${INPUT_FILES[@]}"; do
     ./bm_seq -i "${input_path}" -o "${output_path}_seq.out" -r P
     echo ""
 
+    echo "Running bm_seq (guide tree initial alignment) on ${input_file}"
+    ./bm_seq -i "${input_path}" -o "${output_path}_seq_guide.out" -r P -s G
+    echo ""
+
     echo "Running bm_par (p=2) on ${input_file}"
     mpirun -np 2 ./bm_par -i "${input_path}" -o "${output_path}_par_2.out" -r P
     echo ""
@@ -1,13 +1,21 @@
 #include "bm_comm.h"
 
 #include "align.h"
+#include "batch.h"
 #include "bm_utils.h"
+#include "guide_tree.h"
+#include "metrics.h"
 #include "parse_fasta.h"
+#include "trace.h"
 
 #include <algorithm>
 #include <cstring>
 #include <cassert>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include <mpi.h>
 
@@ -15,57 +23,399 @@
 #define FASTA_DESC 2
 #define FASTA_SEQ 3
 
-char *serialize_fasta_seqs(std::vector<fasta_seq_t>& fasta_seqs, size_t& num_bytes) {
-    num_bytes = 0;
-    for (fasta_seq_t fasta_seq : fasta_seqs) {
-        num_bytes += fasta_seq.ident.size() + 1;
-        num_bytes += fasta_seq.desc.size() + 1;
-        num_bytes += fasta_seq.seq.size() + 1;
+void serialize_fasta_recs(const std::vector<fasta_rec_t>& fasta_recs, std::vector<char>& bytes) {
+    size_t num_bytes = bytes.size();
+    for (const fasta_rec_t& fasta_rec : fasta_recs)
+        num_bytes += fasta_rec.ident.size() + fasta_rec.desc.size() + fasta_rec.seq.size() + 3;
+    bytes.reserve(num_bytes);
+
+    for (const fasta_rec_t& fasta_rec : fasta_recs) {
+        bytes.insert(bytes.end(), fasta_rec.ident.begin(), fasta_rec.ident.end());
+        bytes.push_back('\0');
+        bytes.insert(bytes.end(), fasta_rec.desc.begin(), fasta_rec.desc.end());
+        bytes.push_back('\0');
+        bytes.insert(bytes.end(), fasta_rec.seq.begin(), fasta_rec.seq.end());
+        bytes.push_back('\0');
     }
+    assert(bytes.size() == num_bytes);
+}
+
+std::vector<fasta_rec_t> deserialize_fasta_recs(const char *bytes, size_t num_bytes) {
+    std::vector<fasta_rec_t> fasta_recs{};
+
+    int fasta_parse_state = FASTA_IDENT;
+    fasta_rec_t curr_rec{};
+    const char *curr_str_start = bytes;
+    const char *end = bytes + num_bytes;
+    while (curr_str_start < end) {
+        const char *str_end = static_cast<const char *>(memchr(curr_str_start, '\0', end - curr_str_start));
+        if (str_end == NULL)
+            break;
+        std::string_view str(curr_str_start, str_end - curr_str_start);
 
-    char *bytes = (char *) malloc(num_bytes);
-    size_t pos = 0;
+        if (fasta_parse_state == FASTA_IDENT) {
+            curr_rec.ident = str;
+            fasta_parse_state = FASTA_DESC;
+        } else if (fasta_parse_state == FASTA_DESC) {
+            curr_rec.desc = str;
+            fasta_parse_state = FASTA_SEQ;
+        } else if (fasta_parse_state == FASTA_SEQ) {
+            curr_rec.seq = str;
+            fasta_recs.push_back(curr_rec);
+            fasta_parse_state = FASTA_IDENT;
+        }
 
-    for (fasta_seq_t fasta_seq : fasta_seqs) {
-        memcpy(&bytes[pos], fasta_seq.ident.c_str(), fasta_seq.ident.size() + 1);
-        pos += fasta_seq.ident.size() + 1;
-        memcpy(&bytes[pos], fasta_seq.desc.c_str(), fasta_seq.desc.size() + 1);
-        pos += fasta_seq.desc.size() + 1;
-        memcpy(&bytes[pos], fasta_seq.seq.c_str(), fasta_seq.seq.size() + 1);
-        pos += fasta_seq.seq.size() + 1;
+        curr_str_start = str_end + 1;
     }
-    assert(pos == num_bytes);
 
-    return bytes;
+    return fasta_recs;
 }
 
-std::vector<fasta_seq_t> deserialize_fasta_seqs(char *bytes, size_t num_bytes) {
-    std::vector<fasta_seq_t> fasta_seqs{};
+void bcast_fasta(const std::string& filename, MPI_Comm comm, std::vector<char>& bytes, std::vector<fasta_rec_t>& fasta_recs) {
+    int pid;
+    MPI_Comm_rank(comm, &pid);
 
-    int fasta_parse_state = FASTA_IDENT;
-    static const fasta_seq_t empty_seq;
-    fasta_seq_t curr_seq{};
-    char *curr_str_start = bytes;
-    for (size_t pos = 0; pos < num_bytes; pos++) {
-        if (bytes[pos] == '\0') {
-            if (fasta_parse_state == FASTA_IDENT) {
-                curr_seq.ident = std::string(curr_str_start);
-                fasta_parse_state = FASTA_DESC;
-            } else if (fasta_parse_state == FASTA_DESC) {
-                curr_seq.desc = std::string(curr_str_start);
-                fasta_parse_state = FASTA_SEQ;
-            } else if (fasta_parse_state == FASTA_SEQ) {
-                curr_seq.seq = std::string(curr_str_start);
-                fasta_seqs.push_back(curr_seq);
-                curr_seq = empty_seq;
-                fasta_parse_state = FASTA_IDENT;
-            }
-
-            curr_str_start = &bytes[pos+1];
+    // P0 maps and serializes the FASTA file
+    unsigned long num_bytes = 0;
+    bytes.clear();
+    if (pid == 0) {
+        fasta_map_t fasta_map{};
+        map_fasta(filename, std::thread::hardware_concurrency(), fasta_map);
+        serialize_fasta_recs(fasta_map.recs, bytes);
+        unmap_fasta(fasta_map);
+        num_bytes = bytes.size();
+    }
+
+    MPI_Bcast(&num_bytes, 1, MPI_UNSIGNED_LONG, 0, comm);
+    bytes.resize(num_bytes);
+    MPI_Bcast(bytes.data(), num_bytes, MPI_CHAR, 0, comm);
+    fasta_recs = deserialize_fasta_recs(bytes.data(), bytes.size());
+}
+
+void read_fasta_collective(const std::string& filename, MPI_Comm comm, std::vector<char>& bytes, std::vector<fasta_rec_t>& fasta_recs) {
+    int pid;
+    int nproc;
+    MPI_Comm_rank(comm, &pid);
+    MPI_Comm_size(comm, &nproc);
+
+    MPI_File fh;
+    if (MPI_File_open(comm, filename.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if (pid == 0)
+            std::cerr << "Unable to open file: " << filename << ".\n";
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+    MPI_Offset file_size;
+    MPI_File_get_size(fh, &file_size);
+
+    // Each processor reads an equal byte range, plus the byte before it so
+    // that record starts at the beginning of the range can be recognized
+    MPI_Offset range_start = file_size * pid / nproc;
+    MPI_Offset range_end = file_size * (pid + 1) / nproc;
+    MPI_Offset read_start = range_start > 0 ? range_start - 1 : 0;
+    std::vector<char> chunk(range_end - read_start);
+    MPI_File_read_at_all(fh, read_start, chunk.data(), chunk.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+
+    // Find the first record starting in the range (or file_size if none)
+    char *range_begin = chunk.data() + (range_start - read_start);
+    char *chunk_end = chunk.data() + chunk.size();
+    long long first_rec = file_size;
+    char *rec = next_fasta_rec(chunk.data(), range_begin, chunk_end);
+    if (rec < chunk_end)
+        first_rec = read_start + (rec - chunk.data());
+
+    std::vector<long long> first_recs(nproc);
+    MPI_Allgather(&first_rec, 1, MPI_LONG_LONG, first_recs.data(), 1, MPI_LONG_LONG, comm);
+
+    // Each processor owns the records starting in its range. The last one
+    // continues up to the next record start, which is read as a tail.
+    long long owned_end = file_size;
+    for (int k = pid + 1; k < nproc; k++)
+        owned_end = std::min(owned_end, first_recs[k]);
+    long long tail_len = first_rec < file_size ? owned_end - range_end : 0;
+    size_t owned_start = first_rec - read_start;
+    chunk.resize(chunk.size() + tail_len);
+    MPI_File_read_at_all(fh, range_end, chunk.data() + chunk.size() - tail_len, tail_len, MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+
+    // Parse only the owned records, then share them with every processor
+    std::vector<fasta_rec_t> own_recs{};
+    if (first_rec < file_size)
+        parse_fasta_chunk(chunk.data() + owned_start, chunk.data() + chunk.size(), own_recs);
+    std::vector<char> own_bytes{};
+    serialize_fasta_recs(own_recs, own_bytes);
+
+    int own_len = own_bytes.size();
+    std::vector<int> lens(nproc);
+    std::vector<int> displs(nproc);
+    MPI_Allgather(&own_len, 1, MPI_INT, lens.data(), 1, MPI_INT, comm);
+    int total_len = 0;
+    for (int k = 0; k < nproc; k++) {
+        displs[k] = total_len;
+        total_len += lens[k];
+    }
+
+    bytes.resize(total_len);
+    MPI_Allgatherv(own_bytes.data(), own_len, MPI_CHAR, bytes.data(), lens.data(), displs.data(), MPI_CHAR, comm);
+    fasta_recs = deserialize_fasta_recs(bytes.data(), bytes.size());
+}
+
+void bcast_seq_group(seq_group_t& group, int root, MPI_Comm comm) {
+    int pid;
+    MPI_Comm_rank(comm, &pid);
+
+    // header[0] --> number of sequences, header[1] --> alignment length
+    int header[2];
+    if (pid == root) {
+        header[0] = static_cast<int>(group.size());
+        header[1] = static_cast<int>(group[0].data.size());
+    }
+    MPI_Bcast(header, 2, MPI_INT, root, comm);
+
+    size_t num_seqs = header[0];
+    size_t alnmt_len = header[1];
+    // Ids and weights, interleaved
+    std::vector<int> seq_ids(2 * num_seqs);
+    std::vector<char> alnmt_bytes(num_seqs * alnmt_len);
+    if (pid == root) {
+        for (size_t i = 0; i < num_seqs; i++) {
+            seq_ids[2*i] = group[i].id;
+            seq_ids[2*i+1] = group[i].weight;
+            memcpy(&alnmt_bytes[i * alnmt_len], group[i].data.data(), alnmt_len);
+        }
+    }
+    MPI_Bcast(seq_ids.data(), 2 * num_seqs, MPI_INT, root, comm);
+    MPI_Bcast(alnmt_bytes.data(), num_seqs * alnmt_len, MPI_CHAR, root, comm);
+
+    if (pid != root) {
+        group.resize(num_seqs);
+        for (size_t i = 0; i < num_seqs; i++) {
+            group[i].id = seq_ids[2*i];
+            group[i].weight = seq_ids[2*i+1];
+            group[i].data.assign(&alnmt_bytes[i * alnmt_len], alnmt_len);
+        }
+    }
+}
+
+void bcast_checkpoint(bm_checkpoint_t& ckpt, int root, MPI_Comm comm) {
+    int pid;
+    MPI_Comm_rank(comm, &pid);
+
+    int fields[10];
+    if (pid == root) {
+        fields[0] = ckpt.random_mode;
+        fields[1] = ckpt.partn_kind;
+        fields[2] = ckpt.glbl_idx;
+        fields[3] = ckpt.best_glbl_idx;
+        fields[4] = ckpt.best_score;
+        fields[5] = ckpt.par_step;
+        fields[6] = ckpt.rate.start_idx;
+        fields[7] = ckpt.rate.start_score;
+        fields[8] = static_cast<int>(ckpt.accept_reject_chain.size());
+        fields[9] = static_cast<int>(ckpt.col_stamp.size());
+    }
+    MPI_Bcast(fields, 10, MPI_INT, root, comm);
+
+    if (pid != root) {
+        ckpt.random_mode = fields[0];
+        ckpt.partn_kind = fields[1];
+        ckpt.glbl_idx = fields[2];
+        ckpt.best_glbl_idx = fields[3];
+        ckpt.best_score = fields[4];
+        ckpt.par_step = fields[5];
+        ckpt.rate.start_idx = fields[6];
+        ckpt.rate.start_score = fields[7];
+        ckpt.accept_reject_chain.resize(fields[8]);
+        ckpt.col_stamp.resize(fields[9]);
+    }
+    MPI_Bcast(&ckpt.accept_reject_chain[0], fields[8], MPI_CHAR, root, comm);
+    MPI_Bcast(ckpt.col_stamp.data(), fields[9], MPI_INT, root, comm);
+
+    bcast_seq_group(ckpt.cur_alnmt, root, comm);
+}
+
+void bcast_batch_jobs(std::vector<batch_job_t>& jobs, int root, MPI_Comm comm) {
+    int pid;
+    MPI_Comm_rank(comm, &pid);
+
+    // Filenames are sent NUL-separated, and shapes and costs as doubles
+    std::vector<char> names{};
+    std::vector<double> shapes{};
+    if (pid == root) {
+        for (const batch_job_t& job : jobs) {
+            names.insert(names.end(), job.input_filename.begin(), job.input_filename.end());
+            names.push_back('\0');
+            names.insert(names.end(), job.output_filename.begin(), job.output_filename.end());
+            names.push_back('\0');
+            shapes.push_back(job.num_seqs);
+            shapes.push_back(job.max_len);
+            shapes.push_back(job.cost);
+        }
+    }
+
+    // header[0] --> number of jobs, header[1] --> bytes of names
+    int header[2] = {static_cast<int>(jobs.size()), static_cast<int>(names.size())};
+    MPI_Bcast(header, 2, MPI_INT, root, comm);
+    names.resize(header[1]);
+    shapes.resize(3 * header[0]);
+    MPI_Bcast(names.data(), header[1], MPI_CHAR, root, comm);
+    MPI_Bcast(shapes.data(), 3 * header[0], MPI_DOUBLE, root, comm);
+
+    if (pid != root) {
+        jobs.resize(header[0]);
+        const char *name = names.data();
+        for (int k = 0; k < header[0]; k++) {
+            jobs[k].input_filename = name;
+            name += jobs[k].input_filename.size() + 1;
+            jobs[k].output_filename = name;
+            name += jobs[k].output_filename.size() + 1;
+            jobs[k].num_seqs = shapes[3*k];
+            jobs[k].max_len = shapes[3*k+1];
+            jobs[k].cost = shapes[3*k+2];
+        }
+    }
+}
+
+void create_job_counter(int first, MPI_Comm comm, job_counter_t& counter) {
+    int pid;
+    MPI_Comm_rank(comm, &pid);
+
+    MPI_Aint size = pid == 0 ? sizeof(int) : 0;
+    MPI_Win_allocate(size, sizeof(int), MPI_INFO_NULL, comm, &counter.value, &counter.win);
+    if (pid == 0) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, counter.win);
+        *counter.value = first;
+        MPI_Win_unlock(0, counter.win);
+    }
+    MPI_Barrier(comm);
+}
+
+int fetch_next_job(job_counter_t& counter) {
+    int one = 1;
+    int prev;
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, counter.win);
+    MPI_Fetch_and_op(&one, &prev, MPI_INT, 0, 0, MPI_SUM, counter.win);
+    MPI_Win_unlock(0, counter.win);
+    return prev;
+}
+
+void free_job_counter(job_counter_t& counter) {
+    MPI_Win_free(&counter.win);
+}
+
+void gather_trace(const std::vector<trace_event_t>& events, int root, MPI_Comm comm, std::vector<std::vector<trace_event_t>>& rank_events) {
+    int pid;
+    int nproc;
+    MPI_Comm_rank(comm, &pid);
+    MPI_Comm_size(comm, &nproc);
+
+    // Events are plain data, so they are sent as blocks of bytes. Counts are
+    // in events, which keeps the root's displacements within int.
+    MPI_Datatype MPI_trace_event_t;
+    MPI_Type_contiguous(sizeof(trace_event_t), MPI_BYTE, &MPI_trace_event_t);
+    MPI_Type_commit(&MPI_trace_event_t);
+
+    int num_events = events.size();
+    std::vector<int> counts(nproc, 0);
+    MPI_Gather(&num_events, 1, MPI_INT, counts.data(), 1, MPI_INT, root, comm);
+
+    std::vector<int> displs(nproc, 0);
+    int total_events = 0;
+    for (int r = 0; r < nproc; r++) {
+        displs[r] = total_events;
+        total_events += counts[r];
+    }
+
+    std::vector<trace_event_t> all_events(pid == root ? total_events : 0);
+    MPI_Gatherv(events.data(), num_events, MPI_trace_event_t, all_events.data(), counts.data(), displs.data(), MPI_trace_event_t, root, comm);
+    MPI_Type_free(&MPI_trace_event_t);
+
+    rank_events.clear();
+    if (pid != root)
+        return;
+    for (int r = 0; r < nproc; r++) {
+        auto first = all_events.begin() + displs[r];
+        rank_events.emplace_back(first, first + counts[r]);
+    }
+}
+
+seq_group_t progressive_alnmt_par(const std::vector<fasta_rec_t>& fasta_recs, align_params_t& params, MPI_Comm comm) {
+    int pid;
+    int nproc;
+    MPI_Comm_rank(comm, &pid);
+    MPI_Comm_size(comm, &nproc);
+    int num_seqs = fasta_recs.size();
+
+    // Each processor computes some rows of the distance matrix. Every entry
+    // is computed by exactly one processor, so summing combines them.
+    std::vector<double> dists{};
+    kmer_dists(fasta_recs, pid, nproc, dists);
+    MPI_Allreduce(MPI_IN_PLACE, dists.data(), dists.size(), MPI_DOUBLE, MPI_SUM, comm);
+    guide_tree_t tree = upgma_tree(dists, num_seqs);
+
+    // Align independent subtrees in parallel, then share them
+    std::vector<int> subtrees{};
+    split_subtrees(tree, nproc, subtrees);
+    std::vector<seq_group_t> node_alnmts(tree.size());
+    for (size_t k = pid; k < subtrees.size(); k += nproc)
+        align_subtree(fasta_recs, tree, subtrees[k], params, node_alnmts);
+    for (size_t k = 0; k < subtrees.size(); k++)
+        bcast_seq_group(node_alnmts[subtrees[k]], k % nproc, comm);
+
+    // Every processor aligns the rest of the tree
+    seq_group_t alnmt = align_subtree(fasta_recs, tree, tree.size() - 1, params, node_alnmts);
+
+    std::sort(alnmt.begin(), alnmt.end(), [](const seq_t& a, const seq_t& b) { return a.id < b.id; });
+    return alnmt;
+}
+
+int exchange_best_alnmt(seq_group_t& cur_alnmt, int& best_score, bool converged, bool& leader_converged, int& stop_reason, MPI_Comm comm) {
+    int pid;
+    MPI_Comm_rank(comm, &pid);
+
+    // Element 0 finds the best score, element 1 finds the worst, and
+    // element 2 finds the strongest stop reason. The worst score is
+    // complemented rather than negated, which cannot overflow at INT_MIN.
+    int score_loc[6] = {best_score, pid, ~best_score, pid, stop_reason, pid};
+    int result[6];
+    MPI_Allreduce(score_loc, result, 3, MPI_2INT, MPI_MAXLOC, comm);
+    int leader_score = result[0];
+    int leader_pid = result[1];
+    int worst_score = ~result[2];
+    stop_reason = result[4];
+
+    // Leader broadcasts whether it has converged, and its alignment length
+    int header[2];
+    if (pid == leader_pid) {
+        header[0] = converged ? 1 : 0;
+        header[1] = static_cast<int>(cur_alnmt[0].data.size());
+    }
+    MPI_Bcast(header, 2, MPI_INT, leader_pid, comm);
+    leader_converged = header[0] == 1;
+    loop_metrics.comm_bytes += 2 * sizeof(score_loc) + sizeof(header);
+
+    if (worst_score == leader_score)
+        return leader_pid;
+
+    // Some island lags, so the leader broadcasts its alignment
+    size_t num_seqs = cur_alnmt.size();
+    size_t alnmt_len = header[1];
+    std::vector<char> alnmt_bytes(num_seqs * alnmt_len);
+    if (pid == leader_pid) {
+        for (size_t i = 0; i < num_seqs; i++)
+            memcpy(&alnmt_bytes[i * alnmt_len], cur_alnmt[i].data.data(), alnmt_len);
+    }
+    MPI_Bcast(alnmt_bytes.data(), num_seqs * alnmt_len, MPI_CHAR, leader_pid, comm);
+    loop_metrics.comm_bytes += num_seqs * alnmt_len;
+
+    if (best_score < leader_score) {
+        for (size_t i = 0; i < num_seqs; i++) {
+            cur_alnmt[i].id = i;
+            cur_alnmt[i].data.assign(&alnmt_bytes[i * alnmt_len], alnmt_len);
         }
+        best_score = leader_score;
     }
 
-    return fasta_seqs;
+    return leader_pid;
 }
 
 void accept_op(void *in, void *inout, int *len, MPI_Datatype *dptr) {
@@ -87,6 +437,7 @@ void accept_op(void *in, void *inout, int *len, MPI_Datatype *dptr) {
             result.pid = -1;
             result.flag = REJECT;
         }
+        result.stop = std::max(left.stop, right.stop);
 
         ((pid_flag *) inout)[i] = result;
     }
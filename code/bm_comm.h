@@ -8,28 +8,122 @@
 #define __BM_COMM_H__
 
 #include "align.h"
+#include "batch.h"
+#include "checkpoint.h"
 #include "parse_fasta.h"
+#include "trace.h"
 
+#include <string>
 #include <vector>
 #include <mpi.h>
 
 /**
- * Represents a process ID, and a accept-reject flag.
+ * Represents a process ID, and a accept-reject flag. stop carries a processor's
+ * STOP_* reason, reduced by maximum, so stopping needs no extra collective.
  */
 typedef struct pid_flag {
     int pid;
     int flag;
+    int stop;
 } pid_flag_t;
 
 /**
- * Serializes FASTA sequences into bytes, for communication.
+ * Serializes FASTA records into NUL-separated bytes, for communication. The
+ * bytes are appended to bytes.
  */
-char *serialize_fasta_seqs(std::vector<fasta_seq_t>& fasta_seqs, size_t& num_bytes);
+void serialize_fasta_recs(const std::vector<fasta_rec_t>& fasta_recs, std::vector<char>& bytes);
 
 /**
- * Deserializes bytes into FASTA sequences.
+ * Deserializes bytes into FASTA records, without copying. The records view
+ * into bytes, and are only valid while it is.
  */
-std::vector<fasta_seq_t> deserialize_fasta_seqs(char *bytes, size_t num_bytes);
+std::vector<fasta_rec_t> deserialize_fasta_recs(const char *bytes, size_t num_bytes);
+
+/**
+ * Loads a FASTA file on every processor of comm: processor 0 parses it and
+ * broadcasts it serialized. The records view into bytes.
+ */
+void bcast_fasta(const std::string& filename, MPI_Comm comm, std::vector<char>& bytes, std::vector<fasta_rec_t>& fasta_recs);
+
+/**
+ * Loads a FASTA file on every processor of comm with collective MPI-IO reads.
+ * Each processor reads an equal byte range and parses only the records that
+ * start in it, and the parsed records are allgathered. The records view into
+ * bytes.
+ */
+void read_fasta_collective(const std::string& filename, MPI_Comm comm, std::vector<char>& bytes, std::vector<fasta_rec_t>& fasta_recs);
+
+/**
+ * Broadcasts a sequence group (ids, weights and data) from root to every processor of
+ * comm. All sequences of the group must have the same length.
+ */
+void bcast_seq_group(seq_group_t& group, int root, MPI_Comm comm);
+
+/**
+ * Broadcasts a checkpoint from root to every processor of comm.
+ */
+void bcast_checkpoint(bm_checkpoint_t& ckpt, int root, MPI_Comm comm);
+
+/**
+ * Broadcasts batch jobs (file names and costs) from root to every processor
+ * of comm.
+ */
+void bcast_batch_jobs(std::vector<batch_job_t>& jobs, int root, MPI_Comm comm);
+
+/**
+ * Represents a counter held by processor 0 of a communicator, that any
+ * processor can atomically fetch and increment without processor 0 taking
+ * part.
+ */
+typedef struct job_counter {
+    MPI_Win win;
+    int *value;
+} job_counter_t;
+
+/**
+ * Creates a job counter starting at first. Collective over comm.
+ */
+void create_job_counter(int first, MPI_Comm comm, job_counter_t& counter);
+
+/**
+ * Atomically increments the counter.
+ *
+ * @return The value before incrementing.
+ */
+int fetch_next_job(job_counter_t& counter);
+
+/**
+ * Frees a job counter. Collective over its communicator.
+ */
+void free_job_counter(job_counter_t& counter);
+
+/**
+ * Gathers every processor's trace events to root, indexed by rank. Must be
+ * called by every processor of comm.
+ */
+void gather_trace(const std::vector<trace_event_t>& events, int root, MPI_Comm comm, std::vector<std::vector<trace_event_t>>& rank_events);
+
+/**
+ * Parallel version of progressive_alnmt (see guide_tree.h). k-mer distances
+ * are computed in parallel, and independent subtrees of the guide tree are
+ * aligned on different processors. Must be called by every processor of comm.
+ */
+seq_group_t progressive_alnmt_par(const std::vector<fasta_rec_t>& fasta_recs, align_params_t& params, MPI_Comm comm);
+
+/**
+ * Exchanges the best alignment between islands (independent Berger-Munson
+ * chains). Must be called by every processor of comm. Islands whose score is
+ * lower than the leader's adopt the leader's alignment and score.
+ *
+ * @param cur_alnmt Alignment of the caller's island; replaced if it lags.
+ * @param best_score Score of the caller's island; replaced if it lags.
+ * @param converged Whether the caller's island has converged.
+ * @param leader_converged Set to whether the leader's island has converged.
+ * @param stop_reason The caller's STOP_* reason; set to the largest over all
+ *                    islands, so that they all stop together.
+ * @return Rank (in comm) of the leader, the lowest rank with the best score.
+ */
+int exchange_best_alnmt(seq_group_t& cur_alnmt, int& best_score, bool converged, bool& leader_converged, int& stop_reason, MPI_Comm comm);
 
 /**
  * Custom operation for reducing accepts and flags. Has type MPI_User_function.
@@ -0,0 +1,205 @@
+#include "bm_opts.h"
+#include "autotune.h"
+#include "bm_utils.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <getopt.h>
+
+// Long-only options start after the range of short option characters
+#define OPT_TIME_LIMIT 256
+#define OPT_MAX_ITERS 257
+#define OPT_MIN_RATE 258
+#define OPT_RATE_WINDOW 259
+#define OPT_CHECKPOINT 260
+#define OPT_CHECKPOINT_INTERVAL 261
+#define OPT_RESUME 262
+#define OPT_INPUT_MODE 263
+#define OPT_BATCH 264
+#define OPT_DEDUP 265
+#define OPT_IDENTITY 266
+#define OPT_BANDED 267
+#define OPT_ANCHORED 268
+#define OPT_ANCHOR_CHECK 269
+#define OPT_REFINE 270
+#define OPT_TRACE 271
+#define OPT_AUTOTUNE 272
+#define OPT_AUTOTUNE_CACHE 273
+
+static const struct option long_opts[] = {
+    {"input", required_argument, NULL, 'i'},
+    {"output", required_argument, NULL, 'o'},
+    {"random", required_argument, NULL, 'r'},
+    {"init", required_argument, NULL, 's'},
+    {"partitions", required_argument, NULL, 'p'},
+    {"team-size", required_argument, NULL, 't'},
+    {"islands", required_argument, NULL, 'n'},
+    {"exchange-interval", required_argument, NULL, 'k'},
+    {"time-limit", required_argument, NULL, OPT_TIME_LIMIT},
+    {"max-iters", required_argument, NULL, OPT_MAX_ITERS},
+    {"min-rate", required_argument, NULL, OPT_MIN_RATE},
+    {"rate-window", required_argument, NULL, OPT_RATE_WINDOW},
+    {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+    {"checkpoint-interval", required_argument, NULL, OPT_CHECKPOINT_INTERVAL},
+    {"resume", no_argument, NULL, OPT_RESUME},
+    {"input-mode", required_argument, NULL, OPT_INPUT_MODE},
+    {"batch", required_argument, NULL, OPT_BATCH},
+    {"dedup", required_argument, NULL, OPT_DEDUP},
+    {"identity", required_argument, NULL, OPT_IDENTITY},
+    {"banded", no_argument, NULL, OPT_BANDED},
+    {"anchored", no_argument, NULL, OPT_ANCHORED},
+    {"anchor-check", no_argument, NULL, OPT_ANCHOR_CHECK},
+    {"refine", no_argument, NULL, OPT_REFINE},
+    {"trace", required_argument, NULL, OPT_TRACE},
+    {"autotune", no_argument, NULL, OPT_AUTOTUNE},
+    {"autotune-cache", required_argument, NULL, OPT_AUTOTUNE_CACHE},
+    {NULL, 0, NULL, 0}
+};
+
+bool parse_bm_opts(int argc, char *argv[], bool parallel, bm_opts_t& opts) {
+    int opt;
+    while((opt = getopt_long(argc, argv, "i:o:r:s:p:t:n:k:", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                opts.input_filename = optarg;
+                break;
+            case 'o':
+                opts.output_filename = optarg;
+                break;
+            case 'r':
+                if (optarg[0] == 'R')
+                    opts.random_mode = DEVICERANDOM;
+                else if (optarg[0] == 'P')
+                    opts.random_mode = PSEUDORANDOM;
+                break;
+            case 's':
+                if (optarg[0] == 'N')
+                    opts.init_mode = INIT_NAIIVE;
+                else if (optarg[0] == 'G')
+                    opts.init_mode = INIT_GUIDE_TREE;
+                break;
+            case 'p':
+                if (optarg[0] == 'S')
+                    opts.partn_kind = PARTN_SMALL;
+                else if (optarg[0] == 'T')
+                    opts.partn_kind = PARTN_TREE;
+                else if (optarg[0] == 'B')
+                    opts.partn_kind = PARTN_BALANCED;
+                break;
+            case 't':
+                if (!parallel)
+                    return false;
+                opts.team_size = atoi(optarg);
+                break;
+            case 'n':
+                if (!parallel)
+                    return false;
+                opts.num_islands = atoi(optarg);
+                break;
+            case 'k':
+                if (!parallel)
+                    return false;
+                opts.exchange_interval = atoi(optarg);
+                break;
+            case OPT_TIME_LIMIT:
+                opts.time_limit = atof(optarg);
+                break;
+            case OPT_MAX_ITERS:
+                opts.max_iters = atoi(optarg);
+                break;
+            case OPT_MIN_RATE:
+                opts.min_rate = atof(optarg);
+                break;
+            case OPT_RATE_WINDOW:
+                opts.rate_window = atoi(optarg);
+                break;
+            case OPT_CHECKPOINT:
+                opts.checkpoint_filename = optarg;
+                break;
+            case OPT_CHECKPOINT_INTERVAL:
+                opts.checkpoint_interval = atof(optarg);
+                break;
+            case OPT_RESUME:
+                opts.resume = true;
+                break;
+            case OPT_INPUT_MODE:
+                if (!parallel)
+                    return false;
+                if (optarg[0] == 'b')
+                    opts.input_mode = INPUT_BCAST;
+                else if (optarg[0] == 'm')
+                    opts.input_mode = INPUT_MPIIO;
+                break;
+            case OPT_DEDUP:
+                if (optarg[0] == 'o')
+                    opts.dedup_mode = DEDUP_OFF;
+                else if (optarg[0] == 'e')
+                    opts.dedup_mode = DEDUP_EXACT;
+                else if (optarg[0] == 'n')
+                    opts.dedup_mode = DEDUP_NEAR;
+                break;
+            case OPT_IDENTITY:
+                opts.identity = atof(optarg);
+                break;
+            case OPT_BANDED:
+                opts.banded = true;
+                break;
+            case OPT_ANCHORED:
+                opts.anchored = true;
+                break;
+            case OPT_ANCHOR_CHECK:
+                opts.anchor_check = true;
+                break;
+            case OPT_REFINE:
+                opts.refine = true;
+                break;
+            case OPT_TRACE:
+                opts.trace_filename = optarg;
+                break;
+            case OPT_AUTOTUNE:
+                opts.autotune = true;
+                break;
+            case OPT_AUTOTUNE_CACHE:
+                opts.autotune_cache = optarg;
+                break;
+            case OPT_BATCH:
+                if (!parallel)
+                    return false;
+                opts.batch_filename = optarg;
+                break;
+        default:
+            return false;
+        }
+    }
+
+    // A batch names its inputs and outputs in the manifest
+    if (opts.batch_filename.empty() && (opts.input_filename.empty() || opts.output_filename.empty()))
+        return false;
+    if (opts.rate_window < 1)
+        return false;
+    if (opts.identity <= 0.0 || opts.identity > 1.0)
+        return false;
+    if ((opts.banded && opts.anchored) || (opts.anchor_check && !opts.anchored))
+        return false;
+    if (opts.resume && opts.checkpoint_filename.empty())
+        return false;
+
+    // Finding the default cache creates ~/.cache, so only do it when needed
+    if (opts.autotune && opts.autotune_cache.empty())
+        opts.autotune_cache = default_autotune_cache();
+
+    return true;
+}
+
+void print_bm_usage(const char *prog, bool parallel) {
+    std::cerr << "Usage: " << prog << " -i input_filename -o output_filename -r random_mode [-s init_mode] [-p partn_family]";
+    if (parallel)
+        std::cerr << " [-t team_size] [-n num_islands -k exchange_interval] [--input-mode bcast|mpiio]";
+    std::cerr << " [--dedup off|exact|near [--identity f]] [--banded | --anchored [--anchor-check]] [--refine] [--autotune [--autotune-cache file]]";
+    std::cerr << " [--time-limit sec] [--max-iters n] [--min-rate r --rate-window n]";
+    std::cerr << " [--checkpoint file [--checkpoint-interval sec] [--resume]] [--trace trace_filename]\n";
+    if (parallel)
+        std::cerr << "       " << prog << " --batch manifest [-o summary_filename] (with the options above, except -i, -n, -k, checkpointing and tracing)\n";
+}
@@ -0,0 +1,68 @@
+/** @file bm_opts.h
+ *  Command line options shared by sequential and parallel Berger-Munson.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#ifndef __BM_OPTS_H__
+#define __BM_OPTS_H__
+
+#include "bm_utils.h"
+
+#include <string>
+
+/**
+ * Represents the parsed command line. Budgets of 0 are disabled.
+ */
+typedef struct bm_opts {
+    std::string input_filename;
+    std::string output_filename;
+    int random_mode = DEVICERANDOM;
+    int init_mode = INIT_NAIIVE;
+    int partn_kind = PARTN_SMALL;
+    int dedup_mode = DEDUP_OFF;
+    double identity = 0.98;   // DEDUP_NEAR: fraction of identical positions
+    bool banded = false;      // Banded DP around the current alignment
+    bool anchored = false;    // Align only between consensus anchors
+    bool anchor_check = false; // Compare anchored alignments with full DP
+    bool refine = false;      // Realign around recently changed columns
+    bool autotune = false;    // Time kernel configurations at startup
+    std::string autotune_cache; // Set to default_autotune_cache() with --autotune
+
+    // Anytime budgets
+    double time_limit = 0.0;  // Seconds since program start
+    int max_iters = 0;        // Berger-Munson iterations
+    double min_rate = 0.0;    // Score improvement per iteration
+    int rate_window = 100;    // Iterations the improvement rate is measured over
+
+    // Checkpoint and restart
+    std::string checkpoint_filename;
+    double checkpoint_interval = 60.0; // Seconds between checkpoints
+    bool resume = false;
+    bool checkpoint_sync = false; // Write on the main thread, not in the background
+
+    // Chrome trace of the phases of each step; empty if disabled
+    std::string trace_filename;
+
+    // bm_par only
+    int team_size = 1;
+    int num_islands = 1;
+    int exchange_interval = 10;
+    int input_mode = INPUT_MPIIO;
+    std::string batch_filename; // Manifest of input and output pairs
+} bm_opts_t;
+
+/**
+ * Parses the command line into opts. Options only meaningful for bm_par are
+ * rejected unless parallel is set.
+ *
+ * @return Whether the command line was valid.
+ */
+bool parse_bm_opts(int argc, char *argv[], bool parallel, bm_opts_t& opts);
+
+/**
+ * Prints a usage message to std::cerr.
+ */
+void print_bm_usage(const char *prog, bool parallel);
+
+#endif
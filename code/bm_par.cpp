@@ -6,122 +6,322 @@
 
 #include "parse_fasta.h"
 #include "align.h"
+#include "anchor.h"
+#include "autotune.h"
 #include "bm_utils.h"
+#include "bm_opts.h"
+#include "checkpoint.h"
+#include "guide_tree.h"
+#include "metrics.h"
+#include "refine.h"
+#include "trace.h"
 #include "bm_comm.h"
+#include "align_team.h"
+#include "batch.h"
 
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <limits.h>
+#include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <unistd.h>
 #include <mpi.h>
 
-int main(int argc, char *argv[]) {
-    const auto start_time = CLOCK_NOW;
-
-    // Initialize MPI
+// Outcome of aligning one family, as seen by processor 0 of its communicator
+typedef struct family_result {
+    int num_iters;
+    int best_score;
+    double runtime;
+} family_result_t;
+
+// Aligns opts.input_filename into opts.output_filename on the processors of
+// comm, which must all call it. Time budgets count from start_time. The run
+// is only reported on stdout if report is set.
+static void run_family(bm_opts_t& opts, MPI_Comm comm, std::chrono::steady_clock::time_point start_time, bool report, family_result_t& result) {
     int pid;
     int nproc;
-    MPI_Init(&argc, &argv);
-    MPI_Comm_rank(MPI_COMM_WORLD, &pid);
-    MPI_Comm_size(MPI_COMM_WORLD, &nproc);
-
-    // Parse cmd line args
-    std::string input_filename;
-    std::string output_filename;
-    int random_mode = DEVICERANDOM;
-
-    int opt;
-    while((opt = getopt(argc, argv, "i:o:r:")) != -1) {
-        switch (opt) {
-            case 'i':
-                input_filename = optarg;
-                break;
-            case 'o':
-                output_filename = optarg;
-                break;
-            case 'r':
-                if (optarg[0] == 'R')
-                    random_mode = DEVICERANDOM;
-                else if (optarg[0] == 'P')
-                    random_mode = PSEUDORANDOM;
-                break;
-        default:
-            std::cerr << "Usage: " << argv[0] << " -i input_filename -o output_filename -r random_mode\n";
-            exit(EXIT_FAILURE);
-        }
-    }
-
-    if (empty(input_filename) || empty(output_filename)) {
-        std::cerr << "Usage: " << argv[0] << " -i input_filename -o output_filename -r random_mode\n";
-        exit(EXIT_FAILURE);
-    }
-
-    // P0 parses and serializes FASTA file
-    std::vector<fasta_seq_t> fasta_seqs{};
-    size_t num_bytes = -1;
-    char *fasta_seqs_buf = NULL;
-    if (pid == 0) {
-        std::cout << "Input file: " << input_filename << "\n";
-        fasta_seqs = parse_fasta(input_filename);
-        fasta_seqs_buf = serialize_fasta_seqs(fasta_seqs, num_bytes);
-    }
-
-    // P0 broadcasts FASTA input to other procs
-    MPI_Bcast(&num_bytes, 1, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
-    if (pid > 0)
-        fasta_seqs_buf = (char *) malloc(num_bytes);
-    MPI_Bcast(fasta_seqs_buf, num_bytes, MPI_CHAR, 0, MPI_COMM_WORLD);
-    if (pid > 0)
-        fasta_seqs = deserialize_fasta_seqs(fasta_seqs_buf, num_bytes);
+    MPI_Comm_rank(comm, &pid);
+    MPI_Comm_size(comm, &nproc);
+
+    // Split processors into islands. Each island runs an independent chain,
+    // and islands periodically exchange their best alignment.
+    int island_nproc = nproc / opts.num_islands;
+    int island_id = pid / island_nproc;
+    int island_pid;
+    MPI_Comm island_comm;
+    MPI_Comm_split(comm, island_id, pid, &island_comm);
+    MPI_Comm_rank(island_comm, &island_pid);
+
+    // Split each island into teams. Each team computes one alignment, and
+    // speculation happens across the teams of an island.
+    int num_teams = island_nproc / opts.team_size;
+    int team_id = island_pid / opts.team_size;
+    MPI_Comm team_comm;
+    MPI_Comm_split(island_comm, team_id, island_pid, &team_comm);
+    int team_pid;
+    MPI_Comm_rank(team_comm, &team_pid);
+
+    // Load the FASTA input on every processor. The records view into
+    // fasta_bytes, which lives until the end of the run.
+    if (pid == 0 && report)
+        std::cout << "Input file: " << opts.input_filename << "\n";
+    const auto input_start = CLOCK_NOW;
+    std::vector<char> fasta_bytes{};
+    std::vector<fasta_rec_t> fasta_recs{};
+    if (opts.input_mode == INPUT_BCAST)
+        bcast_fasta(opts.input_filename, comm, fasta_bytes, fasta_recs);
+    else
+        read_fasta_collective(opts.input_filename, comm, fasta_bytes, fasta_recs);
+    const double input_runtime = TIME_SEC(input_start, CLOCK_NOW);
+
+    // Collapse duplicate sequences into weighted rows; the alignment is of
+    // the representatives, and is expanded again at output
+    std::vector<fasta_rec_t> unique_recs{};
+    std::vector<int> weights{};
+    std::vector<int> unique_of{};
+    collapse_fasta_recs(fasta_recs, opts.dedup_mode, opts.identity, unique_recs, weights, unique_of);
 
     // Initialize program state
     align_params_t params{};
 
+    // P0 chooses the fastest alignment kernel for this input, on the naiive
+    // alignment of the representatives
+    autotune_result_t tuned{};
+    if (opts.autotune) {
+        int config[2];
+        if (pid == 0) {
+            seq_group_t tune_alnmt = naiive_alnmt(unique_recs);
+            for (seq_t& seq : tune_alnmt)
+                seq.weight = weights[seq.id];
+            partn_family_t tune_family = make_partn_family(opts.partn_kind, unique_recs);
+            tuned = autotune(tune_alnmt, tune_family, params, opts.autotune_cache);
+            config[0] = tuned.config.kind;
+            config[1] = tuned.config.tile;
+        }
+        MPI_Bcast(config, 2, MPI_INT, 0, comm);
+        kernel_config.kind = config[0];
+        kernel_config.tile = config[1];
+    }
+
     int glbl_idx = 0; // Berger-Munson iteration number
     int par_step = 0; // Sequential step count
 
-    seq_group_t cur_alnmt = naiive_alnmt(fasta_seqs);
+    const auto init_start = CLOCK_NOW;
+    seq_group_t cur_alnmt{};
     int best_score = INT_MIN;
     int best_glbl_idx = -1;
-
-    int num_seqs = fasta_seqs.size();
-    int num_partns = num_seqs + (num_seqs * (num_seqs - 1)) / 2;
+    std::string accept_reject_chain = "";
+    rate_window_t rate{};
+    std::vector<int> ckpt_stamps{};
+    const char *init_name = opts.init_mode == INIT_GUIDE_TREE ? "guide tree" : "naiive";
+
+    if (opts.resume) {
+        // P0 reads the checkpoint and broadcasts it. The chain continues with
+        // the checkpoint's random mode and partition family.
+        bm_checkpoint_t ckpt{};
+        int ckpt_ok = 0;
+        if (pid == 0)
+            ckpt_ok = read_checkpoint(opts.checkpoint_filename, ckpt) && ckpt.cur_alnmt.size() == unique_recs.size();
+        MPI_Bcast(&ckpt_ok, 1, MPI_INT, 0, comm);
+        if (!ckpt_ok) {
+            if (pid == 0)
+                std::cerr << "Unable to resume from checkpoint: " << opts.checkpoint_filename << ".\n";
+            MPI_Finalize();
+            exit(EXIT_FAILURE);
+        }
+        bcast_checkpoint(ckpt, 0, comm);
+
+        opts.random_mode = ckpt.random_mode;
+        opts.partn_kind = ckpt.partn_kind;
+        glbl_idx = ckpt.glbl_idx;
+        best_glbl_idx = ckpt.best_glbl_idx;
+        best_score = ckpt.best_score;
+        par_step = ckpt.par_step;
+        rate = ckpt.rate;
+        accept_reject_chain = std::move(ckpt.accept_reject_chain);
+        cur_alnmt = std::move(ckpt.cur_alnmt);
+        ckpt_stamps = std::move(ckpt.col_stamp);
+        init_name = "checkpoint";
+    } else if (opts.init_mode == INIT_GUIDE_TREE) {
+        cur_alnmt = progressive_alnmt_par(unique_recs, params, comm);
+    } else {
+        cur_alnmt = naiive_alnmt(unique_recs);
+    }
+    for (seq_t& seq : cur_alnmt)
+        seq.weight = weights[seq.id];
+    const int init_score = alnmt_score(cur_alnmt, params);
+    const auto init_end = CLOCK_NOW;
+    const double init_runtime = TIME_SEC(init_start, init_end);
+    const int first_par_step = par_step;
+    const int first_glbl_idx = glbl_idx;
+    if (!opts.resume)
+        rate = rate_window_t{0, init_score};
+
+    partn_family_t partn_family = make_partn_family(opts.partn_kind, unique_recs);
+    int num_partns = partn_family.num_partns;
 
     int flag;
-    std::string accept_reject_chain = "";
+
+    int leader_island = island_id;
+    int num_exchanges = 0;
+    int last_exchange_step = 0;
+
+    int stop_reason = STOP_NONE; // Agreed on by every processor of the island
+
+    checkpoint_writer_t ckpt_writer{};
+    ckpt_writer.sync = opts.checkpoint_sync;
+    auto last_ckpt_time = CLOCK_NOW;
+    int num_adoptions = 0;
+
+    // Windowed refinement waits REFINE_AGE more iterations for convergence,
+    // so a change is last realigned by a full pass. The band can miss a
+    // better path, so banded DP then confirms num_partns more rejections with
+    // full DP.
+    refine_state_t refine{};
+    init_refine(refine, cur_alnmt[0].data.size());
+    if (ckpt_stamps.size() == refine.col_stamp.size())
+        refine.col_stamp = std::move(ckpt_stamps);
+    int num_windowed = 0; // Windowed iterations of island 0's chain
+    const int band_iters = num_partns + (opts.refine ? REFINE_AGE : 0);
+    const int converge_iters = band_iters + (opts.banded ? num_partns : 0);
 
     // Register custom reduction op with MPI
     MPI_Op MPI_accept_op;
     MPI_Datatype MPI_pid_flag_t;
-    MPI_Type_contiguous(2, MPI_INT, &MPI_pid_flag_t);
+    MPI_Type_contiguous(3, MPI_INT, &MPI_pid_flag_t);
     MPI_Type_commit(&MPI_pid_flag_t);
     MPI_Op_create(accept_op, true, &MPI_accept_op);
 
     // Begin speculative computation
     const auto loop_start = CLOCK_NOW;
+    const long long init_cells = dp_stats.cells;
+    loop_metrics = loop_metrics_t{};
+    const double first_iter_time = TIME_SEC(start_time, loop_start);
     double time_in_bcast_1 = 0.0;
     double time_in_bcast_2 = 0.0;
     double time_in_allreduce = 0.0;
     double time_in_par_alg_ovhd = 0.0;
-    while (glbl_idx - (best_glbl_idx + 1) < num_partns) {
+    double time_in_exchange = 0.0;
+    if (!opts.trace_filename.empty()) {
+        // Processors start their trace clocks together
+        MPI_Barrier(comm);
+        enable_trace();
+    }
+    while (true) {
+        trace_buf.step = par_step;
+        bool converged = glbl_idx - (best_glbl_idx + 1) >= converge_iters;
+
+        // Anytime budgets; the current alignment is always the best so far
+        if (stop_reason == STOP_NONE)
+            stop_reason = check_budget(opts.max_iters, opts.min_rate, opts.rate_window, glbl_idx, best_score, rate);
+
+        // Islands exchange every exchange_interval steps. A converged or
+        // stopping island waits in the exchange until the others arrive, and
+        // any island stopping stops them all.
+        if (opts.num_islands > 1 && (converged || stop_reason != STOP_NONE || (par_step % opts.exchange_interval == 0 && par_step != last_exchange_step))) {
+            const auto exchange_start = CLOCK_NOW;
+            TRACE_START(trace_exchange_start);
+            int prev_score = best_score;
+            bool leader_converged;
+            int leader_pid = exchange_best_alnmt(cur_alnmt, best_score, converged, leader_converged, stop_reason, comm);
+            leader_island = leader_pid / island_nproc;
+            num_exchanges++;
+            last_exchange_step = par_step;
+            TRACE_END(TRACE_EXCHANGE, trace_exchange_start);
+            const auto exchange_end = CLOCK_NOW;
+            time_in_exchange += TIME_SEC(exchange_start, exchange_end);
+
+            // The leader's alignment has converged; no island can improve it
+            if (leader_converged) {
+                stop_reason = STOP_CONVERGED;
+                break;
+            }
+            if (stop_reason != STOP_NONE)
+                break;
+
+            // A lagging island restarts its convergence window
+            if (best_score != prev_score) {
+                best_glbl_idx = glbl_idx - 1;
+                num_adoptions++;
+                init_refine(refine, cur_alnmt[0].data.size());
+            }
+            continue;
+        }
+
+        if (converged) {
+            stop_reason = STOP_CONVERGED;
+            break;
+        }
+        if (stop_reason != STOP_NONE)
+            break;
+
+        // Teams past the iteration budget reject without aligning, so that
+        // the budget is exact
+        const int budget_teams = opts.max_iters > 0 ? std::min(num_teams, opts.max_iters - glbl_idx) : num_teams;
+        const bool in_budget = team_id < budget_teams;
+
         // Partition into two groups
         seq_group_t group1{};
         seq_group_t group2{};
-        select_partn(cur_alnmt, glbl_idx + pid, random_mode, group1, group2);
+        TRACE_START(partn_start);
+        int partn_num = 0;
+        if (opts.team_size == 1) {
+            partn_num = select_partn(cur_alnmt, island_id, glbl_idx + team_id, opts.random_mode, partn_family, group1, group2);
+        } else {
+            // Every member must align the same groups; under -r R each would
+            // otherwise draw its own partition
+            if (team_pid == 0)
+                partn_num = select_partn(cur_alnmt, island_id, glbl_idx + team_id, opts.random_mode, partn_family, group1, group2);
+            MPI_Bcast(&partn_num, 1, MPI_INT, 0, team_comm);
+            if (team_pid != 0)
+                build_partn(cur_alnmt, partn_num, partn_family, group1, group2);
+        }
+        TRACE_END(TRACE_PARTN, partn_start);
+
+        // Realign only around recently changed columns, if any
+        int win_start = 0;
+        int win_end = cur_alnmt[0].data.size();
+        bool windowed = opts.refine && refine_window(refine, glbl_idx + team_id, win_start, win_end);
+        bool banded = opts.banded && glbl_idx + team_id - (best_glbl_idx + 1) < band_iters;
 
-        remove_glbl_gaps(group1);
-        remove_glbl_gaps(group2);
+        // The current path of the partition centres the band, and tells which
+        // columns an accept changes
+        gap_pos_t prev_path{};
+        if (banded || (opts.refine && !windowed))
+            prev_path = current_gap_pos(group1, group2);
 
         // Measurement for divergence
         // Compute alignment between two groups
         gap_pos_t gap_pos{};
         // const auto alnmt_start = CLOCK_NOW;
-        int cur_score = align_groups(group1, group2, params, gap_pos);
+        int cur_score;
+        if (!in_budget) {
+            cur_score = INT_MIN;
+        } else if (windowed) {
+            cur_score = align_window(group1, group2, win_start, win_end, best_score, params, prev_path, gap_pos);
+        } else {
+            TRACE_START(remove_start);
+            remove_glbl_gaps(group1);
+            remove_glbl_gaps(group2);
+            TRACE_END(TRACE_REMOVE_GAPS, remove_start);
+            if (banded) {
+                cur_score = align_groups_banded(group1, group2, prev_path, params, gap_pos);
+            } else if (opts.anchored) {
+                cur_score = align_groups_anchored(group1, group2, params, gap_pos);
+                if (opts.anchor_check)
+                    check_anchored(group1, group2, params, cur_score);
+            } else if (opts.team_size == 1) {
+                cur_score = align_groups(group1, group2, params, gap_pos);
+            } else {
+                cur_score = align_groups_team(group1, group2, params, gap_pos, team_comm);
+            }
+        }
         // const auto alnmt_end = CLOCK_NOW;
         //double alnmt_time = TIME_SEC(alnmt_start, alnmt_end);
         // if (par_step % 10 == 0) {
@@ -133,88 +333,99 @@ int main(int argc, char *argv[]) {
         else
             flag = REJECT;
 
-        // Check if any processors accepted, and take the one with lowest pid
+        // Check if any teams accepted, and take the one with lowest team id
         pid_flag_t send_pid_flag{};
-        send_pid_flag.pid = pid;
+        send_pid_flag.pid = team_id;
         send_pid_flag.flag = flag;
+        // Clocks differ between processors, so the time limit is agreed on
+        // through the reduction.
+        send_pid_flag.stop = STOP_NONE;
+        if (opts.time_limit > 0.0 && TIME_SEC(start_time, CLOCK_NOW) >= opts.time_limit)
+            send_pid_flag.stop = STOP_TIME_LIMIT;
         pid_flag_t recv_pid_flag{};
         const auto allreduce_start = CLOCK_NOW;
-        MPI_Allreduce(&send_pid_flag, &recv_pid_flag, 1, MPI_pid_flag_t, MPI_accept_op, MPI_COMM_WORLD);
+        TRACE_START(trace_allreduce_start);
+        MPI_Allreduce(&send_pid_flag, &recv_pid_flag, 1, MPI_pid_flag_t, MPI_accept_op, island_comm);
+        TRACE_END(TRACE_ALLREDUCE, trace_allreduce_start);
+        loop_metrics.comm_bytes += 2 * sizeof(pid_flag_t);
+        if (island_pid == 0)
+            loop_metrics.candidates += budget_teams;
         const auto allreduce_end = CLOCK_NOW;
         time_in_allreduce += TIME_SEC(allreduce_start, allreduce_end);
+        stop_reason = recv_pid_flag.stop;
 
         if (recv_pid_flag.flag == ACCEPT) {
-            int accepted_pid = recv_pid_flag.pid;
+            int accepted_team = recv_pid_flag.pid;
+            int accepted_pid = accepted_team * opts.team_size; // Team leader, in island_comm
+            if (island_id == 0 && windowed && team_id <= accepted_team)
+                num_windowed++;
 
             // Broadcast data from accepted processor to others
-            // index 0 --> size of group1 of partition (1 or 2)
-            // index 1 --> first seq id of group1
-            // index 2 --> second seq id of group1 (if there is one)
-            // index 3 --> score of resulting alignment
-            // index 4 --> length of resulting alignment
-            int accepted_data[5];
-            if (pid == accepted_pid) {
-                accepted_data[0] = static_cast<int>(group1.size());
-                accepted_data[1] = group1[0].id;
-                if (group1.size() == 2)
-                    accepted_data[2] = group1[1].id;
-                else
-                    accepted_data[2] = -1;
-                accepted_data[3] = cur_score;
-                accepted_data[4] = static_cast<int>(gap_pos.size());
+            // index 0 --> partition number within the partition family
+            // index 1 --> score of resulting alignment
+            // index 2 --> length of resulting alignment
+            int accepted_data[3];
+            if (island_pid == accepted_pid) {
+                accepted_data[0] = partn_num;
+                accepted_data[1] = cur_score;
+                accepted_data[2] = static_cast<int>(gap_pos.size());
             }
             const auto bcast_1_start = CLOCK_NOW;
-            MPI_Bcast(accepted_data, 5, MPI_INT, accepted_pid, MPI_COMM_WORLD);
+            TRACE_START(trace_bcast_1_start);
+            MPI_Bcast(accepted_data, 3, MPI_INT, accepted_pid, island_comm);
+            TRACE_END(TRACE_BCAST, trace_bcast_1_start);
+            loop_metrics.comm_bytes += sizeof(accepted_data);
+            if (island_pid == 0)
+                loop_metrics.discarded += budget_teams - 1 - accepted_team;
             const auto bcast_1_end = CLOCK_NOW;
             time_in_bcast_1 += TIME_SEC(bcast_1_start, bcast_1_end);
 
-            if (pid != accepted_pid) {
-                // Reconstruct partition of accepted processor
+            if (team_id != accepted_team) {
+                // Reconstruct partition and window of accepted processor
                 group1.clear();
                 group2.clear();
-
-                int group1_size = accepted_data[0];
-                if (group1_size == 1) {
-                    int group1_first = accepted_data[1];
-                    group1.push_back(cur_alnmt[group1_first]);
-                    for (int i = 0; i < num_seqs; i++) {
-                        if (i != group1_first)
-                            group2.push_back(cur_alnmt[i]);
-                    }
-                } else if (group1_size == 2) {
-                    int group1_first = accepted_data[1];
-                    int group1_second = accepted_data[2];
-                    group1.push_back(cur_alnmt[group1_first]);
-                    group1.push_back(cur_alnmt[group1_second]);
-                    for (int i = 0; i < num_seqs; i++) {
-                        if (i != group1_first && i != group1_second)
-                            group2.push_back(cur_alnmt[i]);
-                    }
+                TRACE_START(rebuild_start);
+                build_partn(cur_alnmt, accepted_data[0], partn_family, group1, group2);
+                TRACE_END(TRACE_PARTN, rebuild_start);
+
+                win_start = 0;
+                win_end = cur_alnmt[0].data.size();
+                windowed = opts.refine && refine_window(refine, glbl_idx + accepted_team, win_start, win_end);
+                if (windowed) {
+                    prev_path = window_gap_pos(group1, group2, win_start, win_end);
+                } else {
+                    if (opts.refine)
+                        prev_path = current_gap_pos(group1, group2);
+                    TRACE_START(remove_start);
+                    remove_glbl_gaps(group1);
+                    remove_glbl_gaps(group2);
+                    TRACE_END(TRACE_REMOVE_GAPS, remove_start);
                 }
-
-                remove_glbl_gaps(group1);
-                remove_glbl_gaps(group2);
             }
 
             // Broadcast gap positions from accepted processor
-            int gap_pos_len = accepted_data[4];
+            int gap_pos_len = accepted_data[2];
             char *gap_pos_bytes = (char *) malloc(gap_pos_len * 2);
 
             // Accepted processor serializes and broadcasts gap positions
-            if (pid == accepted_pid) {
+            if (island_pid == accepted_pid) {
                 for (int i = 0; i < gap_pos_len; i++) {
                     gap_pos_bytes[2*i] = 1 ? gap_pos[i].group1_gap : 0;
                     gap_pos_bytes[2*i+1] = 1 ? gap_pos[i].group2_gap : 0;
                 }
             }
             const auto bcast_2_start = CLOCK_NOW;
-            MPI_Bcast(gap_pos_bytes, gap_pos_len * 2, MPI_CHAR, accepted_pid, MPI_COMM_WORLD);
+            TRACE_START(trace_bcast_2_start);
+            MPI_Bcast(gap_pos_bytes, gap_pos_len * 2, MPI_CHAR, accepted_pid, island_comm);
+            TRACE_END(TRACE_BCAST, trace_bcast_2_start);
+            loop_metrics.comm_bytes += gap_pos_len * 2;
             const auto bcast_2_end = CLOCK_NOW;
             time_in_bcast_2 += TIME_SEC(bcast_2_start, bcast_2_end);
 
             const auto par_alg_ovhd_start = CLOCK_NOW;
+            TRACE_START(update_start);
             // Other processors deserialize gap positions
-            if (pid != accepted_pid) {
+            if (team_id != accepted_team) {
                 gap_pos.clear();
                 for (int i = 0; i < gap_pos_len; i++) {
                     gap_option_t gap_opt;
@@ -225,68 +436,406 @@ int main(int argc, char *argv[]) {
             }
 
             // Update program state for next iteration
-            int accepted_score = accepted_data[3];
+            int accepted_score = accepted_data[1];
             best_score = accepted_score;
-            best_glbl_idx = glbl_idx + accepted_pid;
-            cur_alnmt = update_alnmt(group1, group2, gap_pos);
+            best_glbl_idx = glbl_idx + accepted_team;
+            if (windowed)
+                cur_alnmt = update_alnmt_window(group1, group2, win_start, win_end, gap_pos);
+            else
+                cur_alnmt = update_alnmt(group1, group2, gap_pos);
+            if (opts.refine)
+                update_stamps(refine, prev_path, gap_pos, win_start, win_end, best_glbl_idx);
 
             // Extend the accept-reject chain
-            for (int i = 0; i < accepted_pid; i++)
+            for (int i = 0; i < accepted_team; i++)
                 accept_reject_chain += 'R';
             accept_reject_chain += 'A';
 
-            glbl_idx += accepted_pid + 1;
+            glbl_idx += accepted_team + 1;
+            TRACE_END(TRACE_UPDATE, update_start);
             const auto par_alg_ovhd_end = CLOCK_NOW;
             time_in_par_alg_ovhd += TIME_SEC(par_alg_ovhd_start, par_alg_ovhd_end);
         } else if (recv_pid_flag.flag == REJECT) {
-            // All processors have rejected
-            for (int i = 0; i < nproc; i++)
+            // All teams within the budget have rejected
+            if (island_id == 0 && windowed && in_budget)
+                num_windowed++;
+            for (int i = 0; i < budget_teams; i++)
                 accept_reject_chain += 'R';
-            glbl_idx += nproc;
+            glbl_idx += budget_teams;
         }
 
         par_step++;
+
+        // P0 periodically checkpoints in the background; no other processor
+        // takes part, so the loop does not stall
+        if (pid == 0 && !opts.checkpoint_filename.empty() && TIME_SEC(last_ckpt_time, CLOCK_NOW) >= opts.checkpoint_interval) {
+            bm_checkpoint_t ckpt{opts.random_mode, opts.partn_kind, glbl_idx, best_glbl_idx, best_score, par_step, rate, accept_reject_chain, cur_alnmt, opts.refine ? refine.col_stamp : std::vector<int>{}};
+            write_checkpoint_async(ckpt_writer, opts.checkpoint_filename, ckpt);
+            last_ckpt_time = CLOCK_NOW;
+        }
     }
+    wait_checkpoint(ckpt_writer);
     const auto loop_end = CLOCK_NOW;
     const double loop_runtime = TIME_SEC(loop_start, loop_end);
-    const double avg_iter_runtime = loop_runtime / static_cast<double>(par_step);
+    const double avg_iter_runtime = loop_runtime / static_cast<double>(par_step - first_par_step);
 
     const auto end_time = CLOCK_NOW;
     const double runtime = TIME_SEC(start_time, end_time);
 
+    result.num_iters = glbl_idx;
+    result.best_score = best_score;
+    result.runtime = runtime;
+
+    // DP work summed over every processor
+    long long local_dp[10] = {dp_stats.cells, dp_stats.full_cells, dp_stats.band_regrows, dp_stats.full_fallbacks,
+                              dp_stats.anchored_alnmts, dp_stats.anchor_cols, dp_stats.anchor_checks, dp_stats.anchor_loss, dp_stats.anchor_worse,
+                              num_windowed};
+    long long total_dp[10];
+    MPI_Reduce(local_dp, total_dp, 10, MPI_LONG_LONG, MPI_SUM, 0, comm);
+
+    // Efficiency metrics, per rank and over the island leaders' candidates
+    metrics_report_t metrics{};
+    long long rank_cells = dp_stats.cells - init_cells;
+    metrics.rank_cells.resize(nproc);
+    metrics.rank_loop_sec.resize(nproc);
+    metrics.rank_comm_bytes.resize(nproc);
+    MPI_Gather(&rank_cells, 1, MPI_LONG_LONG, metrics.rank_cells.data(), 1, MPI_LONG_LONG, 0, comm);
+    MPI_Gather(&loop_runtime, 1, MPI_DOUBLE, metrics.rank_loop_sec.data(), 1, MPI_DOUBLE, 0, comm);
+    MPI_Gather(&loop_metrics.comm_bytes, 1, MPI_LONG_LONG, metrics.rank_comm_bytes.data(), 1, MPI_LONG_LONG, 0, comm);
+    long long local_spec[2] = {loop_metrics.candidates, loop_metrics.discarded};
+    long long total_spec[2];
+    MPI_Reduce(local_spec, total_spec, 2, MPI_LONG_LONG, MPI_SUM, 0, comm);
+    dp_stats = dp_stats_t{};
+
+    // Per-rank phase trace, gathered to P0
+    if (trace_buf.enabled) {
+        std::vector<std::vector<trace_event_t>> rank_events{};
+        gather_trace(trace_events(), 0, comm, rank_events);
+        long long num_recorded = trace_buf.num_recorded;
+        long long total_recorded;
+        MPI_Reduce(&num_recorded, &total_recorded, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+        if (pid == 0) {
+            size_t num_events = 0;
+            for (const std::vector<trace_event_t>& events : rank_events)
+                num_events += events.size();
+            if (write_chrome_trace(opts.trace_filename, rank_events))
+                std::cout << "Trace: " << opts.trace_filename << " (" << num_events << " events, " << total_recorded - num_events << " overwritten)\n";
+            else
+                std::cerr << "Unable to write trace: " << opts.trace_filename << ".\n";
+        }
+        trace_buf = trace_buf_t{};
+    }
+
+    // Near-duplicates differ from their representative, so the expanded
+    // alignment has its own score
+    seq_group_t out_alnmt{};
+    int expanded_score = best_score;
+    if (pid == 0) {
+        out_alnmt = expand_alnmt(cur_alnmt, fasta_recs, unique_of);
+        if (opts.dedup_mode == DEDUP_NEAR)
+            expanded_score = alnmt_score(out_alnmt, params);
+    }
+
+    const std::string metrics_file = metrics_filename(opts.output_filename);
     if (pid == 0) {
+        metrics.program = "bm_par";
+        metrics.num_iters = glbl_idx;
+        metrics.num_steps = par_step - first_par_step;
+        metrics.best_score = best_score;
+        metrics.runtime = runtime;
+        metrics.loop_runtime = loop_runtime;
+        metrics.candidates = total_spec[0];
+        metrics.discarded = total_spec[1];
+        metrics.accept_reject_chain = accept_reject_chain;
+        if (!write_metrics(metrics_file, metrics))
+            std::cerr << "Unable to write metrics: " << metrics_file << ".\n";
+    }
+
+    if (pid == 0 && report) {
         std::cout << "Ran for " << glbl_idx << " iterations.\n";
         std::cout << "Took " << par_step << " parallel steps.\n";
+        std::cout << "Stopped by: " << stop_reason_name(stop_reason) << "\n";
+        std::cout << "Teams: " << num_teams << " (team size " << opts.team_size << ")\n";
+        if (opts.num_islands > 1) {
+            std::cout << "Islands: " << opts.num_islands << " (exchange every " << opts.exchange_interval << " steps)\n";
+            std::cout << "Exchanges: " << num_exchanges << ", adoptions by island 0: " << num_adoptions << ", leader island: " << leader_island << "\n";
+        }
         std::cout << "Runtime (sec): " << runtime << "\n";
         std::cout << "Runtime per iteration (sec): " << avg_iter_runtime << "\n";
+        std::cout << "DP cells computed: " << total_dp[0] << " of " << total_dp[1] << " (" << 100.0 * total_dp[0] / total_dp[1] << "%), band regrows: " << total_dp[2] << ", full fallbacks: " << total_dp[3] << "\n";
+        if (opts.anchored)
+            std::cout << "Anchored alignments: " << total_dp[4] << ", anchor columns: " << total_dp[5] << "\n";
+        if (opts.anchor_check)
+            std::cout << "Anchor check: " << total_dp[6] << " alignments, mean score loss " << static_cast<double>(total_dp[7]) / total_dp[6] << ", worse in " << total_dp[8] << "\n";
+        if (opts.refine)
+            std::cout << "Refinement: " << total_dp[9] << " windowed, " << glbl_idx - first_glbl_idx - total_dp[9] << " full passes\n";
+        std::cout << "Partition family: " << partn_family_name(opts.partn_kind) << " (window " << num_partns << ")\n";
+        std::cout << "Input loading: " << (opts.input_mode == INPUT_BCAST ? "bcast" : "mpiio") << " (" << input_runtime << " sec)\n";
+        std::cout << "Time to first iteration (sec): " << first_iter_time << "\n";
+        std::cout << "Initial alignment: " << init_name << " (score = " << init_score << ", " << init_runtime << " sec)\n";
+        if (opts.autotune)
+            std::cout << "Kernel: " << kernel_name(kernel_config.kind) << " (tile " << kernel_config.tile << "), " << (tuned.cached ? "cached" : "tuned") << " in " << tuned.tune_sec << " sec\n";
+        std::cout << "Unique sequences: " << unique_recs.size() << " of " << fasta_recs.size() << " (dedup " << dedup_mode_name(opts.dedup_mode) << ")\n";
         std::cout << "Time in Bcast 1 (sec): " << time_in_bcast_1 << "\n";
         std::cout << "Time in Bcast 2 (sec): " << time_in_bcast_2 << "\n";
         std::cout << "Time in Allreduce (sec): " << time_in_allreduce << "\n";
         std::cout << "Time in par alg overhead (sec): " << time_in_par_alg_ovhd << "\n";
+        if (opts.num_islands > 1)
+            std::cout << "Time in island exchange (sec): " << time_in_exchange << "\n";
         std::cout << "Alignment score: " << best_score << "\n";
+        if (opts.dedup_mode == DEDUP_NEAR)
+            std::cout << "Expanded alignment score: " << expanded_score << "\n";
         std::cout << "Accepts and rejects: " << accept_reject_chain << "\n";
+        std::cout << "Metrics: " << metrics_file << "\n";
+    }
 
-        std::ofstream fout(output_filename);
+    if (pid == 0) {
+        std::ofstream fout(opts.output_filename);
 
         fout << "Ran for " << glbl_idx << " iterations.\n";
         fout << "Took " << par_step << " parallel steps.\n";
+        fout << "Stopped by: " << stop_reason_name(stop_reason) << "\n";
+        fout << "Teams: " << num_teams << " (team size " << opts.team_size << ")\n";
+        if (opts.num_islands > 1) {
+            fout << "Islands: " << opts.num_islands << " (exchange every " << opts.exchange_interval << " steps)\n";
+            fout << "Exchanges: " << num_exchanges << ", adoptions by island 0: " << num_adoptions << ", leader island: " << leader_island << "\n";
+        }
         fout << "Runtime (sec): " << runtime << "\n";
         fout << "Runtime per iteration (sec): " << avg_iter_runtime << "\n";
+        fout << "DP cells computed: " << total_dp[0] << " of " << total_dp[1] << " (" << 100.0 * total_dp[0] / total_dp[1] << "%), band regrows: " << total_dp[2] << ", full fallbacks: " << total_dp[3] << "\n";
+        if (opts.anchored)
+            fout << "Anchored alignments: " << total_dp[4] << ", anchor columns: " << total_dp[5] << "\n";
+        if (opts.anchor_check)
+            fout << "Anchor check: " << total_dp[6] << " alignments, mean score loss " << static_cast<double>(total_dp[7]) / total_dp[6] << ", worse in " << total_dp[8] << "\n";
+        if (opts.refine)
+            fout << "Refinement: " << total_dp[9] << " windowed, " << glbl_idx - first_glbl_idx - total_dp[9] << " full passes\n";
+        fout << "Partition family: " << partn_family_name(opts.partn_kind) << " (window " << num_partns << ")\n";
+        fout << "Initial alignment: " << init_name << " (score = " << init_score << ", " << init_runtime << " sec)\n";
+        if (opts.autotune)
+            fout << "Kernel: " << kernel_name(kernel_config.kind) << " (tile " << kernel_config.tile << "), " << (tuned.cached ? "cached" : "tuned") << " in " << tuned.tune_sec << " sec\n";
+        fout << "Unique sequences: " << unique_recs.size() << " of " << fasta_recs.size() << " (dedup " << dedup_mode_name(opts.dedup_mode) << ")\n";
         fout << "Time in Bcast 1 (sec): " << time_in_bcast_1 << "\n";
         fout << "Time in Bcast 2 (sec): " << time_in_bcast_2 << "\n";
         fout << "Time in Allreduce (sec): " << time_in_allreduce << "\n";
         fout << "Time in par alg overhead (sec): " << time_in_par_alg_ovhd << "\n";
+        if (opts.num_islands > 1)
+            fout << "Time in island exchange (sec): " << time_in_exchange << "\n";
         fout << "Alignment score: " << best_score << "\n";
+        if (opts.dedup_mode == DEDUP_NEAR)
+            fout << "Expanded alignment score: " << expanded_score << "\n";
         fout << "Accepts and rejects: " << accept_reject_chain << "\n";
 
         fout << "Final alignment (score = " << best_score << "):\n";
         fout << "\n\n";
-        for (seq_t seq : cur_alnmt) {
+        for (seq_t seq : out_alnmt) {
             fout << "seq " << std::setw(3) << seq.id << ": ";
             fout << seq.data << "\n";
         }
     }
 
+    MPI_Comm_free(&team_comm);
+    MPI_Comm_free(&island_comm);
     MPI_Op_free(&MPI_accept_op);
+}
+
+// Aligns every family of the manifest opts.batch_filename. Processors are split
+// into one group per costly family, sized by the families' costs, and each
+// group takes the next costliest family when it finishes one.
+static void run_batch(bm_opts_t& opts) {
+    const auto batch_start = CLOCK_NOW;
+
+    int pid;
+    int nproc;
+    MPI_Comm_rank(MPI_COMM_WORLD, &pid);
+    MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+
+    // P0 reads the manifest and orders the families longest first
+    std::vector<batch_job_t> jobs{};
+    int batch_ok = 1;
+    if (pid == 0) {
+        batch_ok = read_manifest(opts.batch_filename, jobs) && !jobs.empty() && estimate_costs(jobs);
+        std::stable_sort(jobs.begin(), jobs.end(), [](const batch_job_t& a, const batch_job_t& b) { return a.cost > b.cost; });
+    }
+    MPI_Bcast(&batch_ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!batch_ok) {
+        if (pid == 0)
+            std::cerr << "Unable to read batch manifest: " << opts.batch_filename << ".\n";
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+    bcast_batch_jobs(jobs, 0, MPI_COMM_WORLD);
+    int num_jobs = jobs.size();
+
+    // Groups are made of whole teams; leftover processors sit out
+    std::vector<int> group_sizes = size_groups(jobs, nproc / opts.team_size);
+    int num_groups = group_sizes.size();
+    int group_id = MPI_UNDEFINED;
+    int group_start = 0;
+    for (int k = 0; k < num_groups; k++) {
+        int group_end = group_start + group_sizes[k] * opts.team_size;
+        if (pid >= group_start && pid < group_end)
+            group_id = k;
+        group_start = group_end;
+    }
+    MPI_Comm group_comm;
+    MPI_Comm_split(MPI_COMM_WORLD, group_id, pid, &group_comm);
+
+    // Group k starts with family k, the one it was sized for; later
+    // families are handed out in order as groups finish
+    job_counter_t counter{};
+    create_job_counter(num_groups, MPI_COMM_WORLD, counter);
+
+    // Per family: index, processors, iterations, score, runtime
+    std::vector<double> results{};
+    if (group_comm != MPI_COMM_NULL) {
+        int group_pid;
+        int group_nproc;
+        MPI_Comm_rank(group_comm, &group_pid);
+        MPI_Comm_size(group_comm, &group_nproc);
+
+        int job = group_id;
+        while (job < num_jobs) {
+            bm_opts_t job_opts = opts;
+            job_opts.input_filename = jobs[job].input_filename;
+            job_opts.output_filename = jobs[job].output_filename;
+            family_result_t result{};
+            run_family(job_opts, group_comm, CLOCK_NOW, false, result);
+            if (group_pid == 0) {
+                results.insert(results.end(), {static_cast<double>(job), static_cast<double>(group_nproc),
+                                               static_cast<double>(result.num_iters), static_cast<double>(result.best_score), result.runtime});
+                job = fetch_next_job(counter);
+            }
+            MPI_Bcast(&job, 1, MPI_INT, 0, group_comm);
+        }
+        MPI_Comm_free(&group_comm);
+    }
+    free_job_counter(counter);
+    const double batch_runtime = TIME_SEC(batch_start, CLOCK_NOW);
+
+    // P0 gathers the results of every family
+    int num_results = results.size();
+    std::vector<int> result_lens(nproc);
+    std::vector<int> result_displs(nproc);
+    MPI_Gather(&num_results, 1, MPI_INT, result_lens.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    int total_results = 0;
+    for (int k = 0; k < nproc; k++) {
+        result_displs[k] = total_results;
+        total_results += result_lens[k];
+    }
+    std::vector<double> all_results(total_results);
+    MPI_Gatherv(results.data(), num_results, MPI_DOUBLE, all_results.data(), result_lens.data(), result_displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    if (pid == 0) {
+        std::ofstream fout{};
+        if (!opts.output_filename.empty())
+            fout.open(opts.output_filename);
+
+        // Report families longest first, whichever group ran them
+        std::vector<int> order{};
+        for (int r = 0; r < total_results; r += 5)
+            order.push_back(r);
+        std::sort(order.begin(), order.end(), [&all_results](int a, int b) { return all_results[a] < all_results[b]; });
+
+        double total_cost = 0.0;
+        double busy_time = 0.0; // Processor-seconds spent aligning
+        for (int r : order) {
+            const batch_job_t& job = jobs[static_cast<int>(all_results[r])];
+            int job_nproc = all_results[r+1];
+            int num_iters = all_results[r+2];
+            int score = all_results[r+3];
+            double runtime = all_results[r+4];
+            total_cost += job.cost;
+            busy_time += runtime * job_nproc;
+
+            std::ostringstream line{};
+            line << "Family " << job.input_filename << " (" << job.num_seqs << " sequences, length " << job.max_len << "): "
+                 << job_nproc << " procs, " << num_iters << " iterations, score " << score << ", "
+                 << runtime << " sec, " << num_iters / runtime << " iterations/sec\n";
+            std::cout << line.str();
+            if (fout)
+                fout << line.str();
+        }
+
+        std::ostringstream summary{};
+        summary << "Batch: " << num_jobs << " families in " << batch_runtime << " sec (" << num_groups << " groups)\n";
+        summary << "Throughput: " << num_jobs / batch_runtime << " families/sec, " << total_cost / batch_runtime << " N*L cells/sec\n";
+        summary << "Processor utilization: " << busy_time / (batch_runtime * nproc) << "\n";
+        std::cout << summary.str();
+        if (fout)
+            fout << summary.str();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const auto start_time = CLOCK_NOW;
+
+    // Initialize MPI
+    int pid;
+    int nproc;
+    // Only the main thread calls MPI; rank 0 writes checkpoints on a helper
+    int thread_level;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_level);
+    MPI_Comm_rank(MPI_COMM_WORLD, &pid);
+    MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+
+    // Parse cmd line args
+    bm_opts_t opts{};
+    if (!parse_bm_opts(argc, argv, true, opts)) {
+        if (pid == 0)
+            print_bm_usage(argv[0], true);
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    // Without thread support MPI allows no other thread, so checkpoints are
+    // written on the main thread
+    if (thread_level < MPI_THREAD_FUNNELED && !opts.checkpoint_filename.empty()) {
+        if (pid == 0)
+            std::cerr << "MPI does not support threads; checkpoints are written synchronously.\n";
+        opts.checkpoint_sync = true;
+    }
+
+    if (opts.num_islands < 1 || nproc % opts.num_islands != 0 || opts.exchange_interval < 1) {
+        if (pid == 0)
+            std::cerr << "Number of islands must divide the number of processors.\n";
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts.num_islands > 1 && !opts.checkpoint_filename.empty()) {
+        if (pid == 0)
+            std::cerr << "Checkpointing is not supported in island mode.\n";
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    if (!opts.batch_filename.empty() && (opts.num_islands > 1 || !opts.checkpoint_filename.empty() || !opts.trace_filename.empty() || opts.team_size > nproc)) {
+        if (pid == 0)
+            std::cerr << "Batch mode does not support islands, checkpointing or tracing, and needs at least one team.\n";
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    if ((opts.banded || opts.anchored || opts.refine) && opts.team_size > 1) {
+        if (pid == 0)
+            std::cerr << "Banded and anchored DP and refinement are not supported with teams.\n";
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts.team_size < 1 || (opts.batch_filename.empty() && (nproc / opts.num_islands) % opts.team_size != 0)) {
+        if (pid == 0)
+            std::cerr << "Team size must divide the number of processors per island.\n";
+        MPI_Finalize();
+        exit(EXIT_FAILURE);
+    }
+
+    if (!opts.batch_filename.empty()) {
+        run_batch(opts);
+    } else {
+        family_result_t result{};
+        run_family(opts, MPI_COMM_WORLD, start_time, true, result);
+    }
+
     MPI_Finalize();
 }
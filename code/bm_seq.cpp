@@ -6,7 +6,15 @@
 
 #include "parse_fasta.h"
 #include "align.h"
+#include "anchor.h"
+#include "autotune.h"
 #include "bm_utils.h"
+#include "bm_opts.h"
+#include "checkpoint.h"
+#include "guide_tree.h"
+#include "metrics.h"
+#include "refine.h"
+#include "trace.h"
 
 #include <chrono>
 #include <fstream>
@@ -14,6 +22,8 @@
 #include <iostream>
 #include <limits.h>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <unistd.h>
@@ -22,105 +32,279 @@ int main(int argc, char *argv[]) {
     const auto start_time = CLOCK_NOW;
 
     // Parse cmd line args
-    std::string input_filename;
-    std::string output_filename;
-    int random_mode = DEVICERANDOM;
-
-    int opt;
-    while((opt = getopt(argc, argv, "i:o:r:")) != -1) {
-        switch (opt) {
-            case 'i':
-                input_filename = optarg;
-                break;
-            case 'o':
-                output_filename = optarg;
-                break;
-            case 'r':
-                if (optarg[0] == 'R')
-                    random_mode = DEVICERANDOM;
-                else if (optarg[0] == 'P')
-                    random_mode = PSEUDORANDOM;
-                break;
-        default:
-            std::cerr << "Usage: " << argv[0] << " -i input_filename -o output_filename -r random_mode\n";
-            exit(EXIT_FAILURE);
-        }
-    }
-
-    if (empty(input_filename) || empty(output_filename)) {
-        std::cerr << "Usage: " << argv[0] << " -i input_filename -o output_filename -r random_mode\n";
+    bm_opts_t opts{};
+    if (!parse_bm_opts(argc, argv, false, opts)) {
+        print_bm_usage(argv[0], false);
         exit(EXIT_FAILURE);
     }
 
     // Parse FASTA file
-    std::cout << "Input file: " << input_filename << "\n";
-    std::vector<fasta_seq_t> fasta_seqs = parse_fasta(input_filename);
+    std::cout << "Input file: " << opts.input_filename << "\n";
+    fasta_map_t fasta_map{};
+    map_fasta(opts.input_filename, std::thread::hardware_concurrency(), fasta_map);
+    std::vector<fasta_rec_t>& fasta_recs = fasta_map.recs;
+
+    // Collapse duplicate sequences into weighted rows; the alignment is of
+    // the representatives, and is expanded again at output
+    std::vector<fasta_rec_t> unique_recs{};
+    std::vector<int> weights{};
+    std::vector<int> unique_of{};
+    collapse_fasta_recs(fasta_recs, opts.dedup_mode, opts.identity, unique_recs, weights, unique_of);
 
     // Initialize program state
     align_params_t params{};
 
+    // Choose the fastest alignment kernel for this input, on the naiive
+    // alignment of the representatives
+    autotune_result_t tuned{};
+    if (opts.autotune) {
+        seq_group_t tune_alnmt = naiive_alnmt(unique_recs);
+        for (seq_t& seq : tune_alnmt)
+            seq.weight = weights[seq.id];
+        partn_family_t tune_family = make_partn_family(opts.partn_kind, unique_recs);
+        tuned = autotune(tune_alnmt, tune_family, params, opts.autotune_cache);
+        kernel_config = tuned.config;
+    }
+
     int glbl_idx = 0; // Berger-Munson iteration number
 
-    seq_group_t cur_alnmt = naiive_alnmt(fasta_seqs);
+    const auto init_start = CLOCK_NOW;
+    seq_group_t cur_alnmt{};
     int best_score = INT_MIN;
     int best_glbl_idx = -1;
+    std::string accept_reject_chain = "";
+    rate_window_t rate{};
+    std::vector<int> ckpt_stamps{};
+    const char *init_name = opts.init_mode == INIT_GUIDE_TREE ? "guide tree" : "naiive";
 
-    int num_seqs = fasta_seqs.size();
-    int num_partns = num_seqs + (num_seqs * (num_seqs - 1)) / 2;
+    if (opts.resume) {
+        // Continue the chain from a checkpoint, including its random mode
+        // and partition family
+        bm_checkpoint_t ckpt{};
+        if (!read_checkpoint(opts.checkpoint_filename, ckpt) || ckpt.cur_alnmt.size() != unique_recs.size()) {
+            std::cerr << "Unable to resume from checkpoint: " << opts.checkpoint_filename << ".\n";
+            exit(EXIT_FAILURE);
+        }
+        opts.random_mode = ckpt.random_mode;
+        opts.partn_kind = ckpt.partn_kind;
+        glbl_idx = ckpt.glbl_idx;
+        best_glbl_idx = ckpt.best_glbl_idx;
+        best_score = ckpt.best_score;
+        rate = ckpt.rate;
+        accept_reject_chain = std::move(ckpt.accept_reject_chain);
+        cur_alnmt = std::move(ckpt.cur_alnmt);
+        ckpt_stamps = std::move(ckpt.col_stamp);
+        init_name = "checkpoint";
+    } else if (opts.init_mode == INIT_GUIDE_TREE) {
+        cur_alnmt = progressive_alnmt(unique_recs, params);
+    } else {
+        cur_alnmt = naiive_alnmt(unique_recs);
+    }
+    for (seq_t& seq : cur_alnmt)
+        seq.weight = weights[seq.id];
+    const int init_score = alnmt_score(cur_alnmt, params);
+    const auto init_end = CLOCK_NOW;
+    const double init_runtime = TIME_SEC(init_start, init_end);
+    const int first_glbl_idx = glbl_idx;
+    if (!opts.resume)
+        rate = rate_window_t{0, init_score};
 
-    std::string accept_reject_chain = "";
+    partn_family_t partn_family = make_partn_family(opts.partn_kind, unique_recs);
+    int num_partns = partn_family.num_partns;
+
+    int stop_reason = STOP_NONE;
+
+    // Windowed refinement waits REFINE_AGE more iterations for convergence,
+    // so a change is last realigned by a full pass. The band can miss a
+    // better path, so banded DP then confirms num_partns more rejections with
+    // full DP.
+    refine_state_t refine{};
+    init_refine(refine, cur_alnmt[0].data.size());
+    if (ckpt_stamps.size() == refine.col_stamp.size())
+        refine.col_stamp = std::move(ckpt_stamps);
+    int num_windowed = 0;
+    const int band_iters = num_partns + (opts.refine ? REFINE_AGE : 0);
+    const int converge_iters = band_iters + (opts.banded ? num_partns : 0);
+
+    checkpoint_writer_t ckpt_writer{};
+    auto last_ckpt_time = CLOCK_NOW;
 
     const auto loop_start = CLOCK_NOW;
-    while (glbl_idx - (best_glbl_idx + 1) < num_partns) {
+    const long long init_cells = dp_stats.cells;
+    if (!opts.trace_filename.empty())
+        enable_trace();
+    while (true) {
+        trace_buf.step = glbl_idx;
+        if (glbl_idx - (best_glbl_idx + 1) >= converge_iters) {
+            stop_reason = STOP_CONVERGED;
+            break;
+        }
+
+        // Anytime budgets; the current alignment is always the best so far
+        stop_reason = check_budget(opts.max_iters, opts.min_rate, opts.rate_window, glbl_idx, best_score, rate);
+        if (stop_reason == STOP_NONE && opts.time_limit > 0.0 && TIME_SEC(start_time, CLOCK_NOW) >= opts.time_limit)
+            stop_reason = STOP_TIME_LIMIT;
+        if (stop_reason != STOP_NONE)
+            break;
+
         // Partition into two groups
         seq_group_t group1{};
         seq_group_t group2{};
-        select_partn(cur_alnmt, glbl_idx, random_mode, group1, group2);
+        TRACE_START(partn_start);
+        select_partn(cur_alnmt, 0, glbl_idx, opts.random_mode, partn_family, group1, group2);
+        TRACE_END(TRACE_PARTN, partn_start);
 
-        remove_glbl_gaps(group1);
-        remove_glbl_gaps(group2);
+        // Realign only around recently changed columns, if any
+        int win_start = 0;
+        int win_end = cur_alnmt[0].data.size();
+        bool windowed = opts.refine && refine_window(refine, glbl_idx, win_start, win_end);
+        bool banded = opts.banded && glbl_idx - (best_glbl_idx + 1) < band_iters;
+
+        // The current path of the partition centres the band, and tells which
+        // columns an accept changes
+        gap_pos_t prev_path{};
+        if (banded || (opts.refine && !windowed))
+            prev_path = current_gap_pos(group1, group2);
 
         // Compute alignment between two groups
         gap_pos_t gap_pos{};
-        int cur_score = align_groups(group1, group2, params, gap_pos);
+        int cur_score;
+        if (windowed) {
+            cur_score = align_window(group1, group2, win_start, win_end, best_score, params, prev_path, gap_pos);
+            num_windowed++;
+        } else {
+            TRACE_START(remove_start);
+            remove_glbl_gaps(group1);
+            remove_glbl_gaps(group2);
+            TRACE_END(TRACE_REMOVE_GAPS, remove_start);
+            if (banded) {
+                cur_score = align_groups_banded(group1, group2, prev_path, params, gap_pos);
+            } else if (opts.anchored) {
+                cur_score = align_groups_anchored(group1, group2, params, gap_pos);
+                if (opts.anchor_check)
+                    check_anchored(group1, group2, params, cur_score);
+            } else {
+                cur_score = align_groups(group1, group2, params, gap_pos);
+            }
+        }
 
         if (cur_score > best_score) {
             // Update program state
             best_score = cur_score;
             best_glbl_idx = glbl_idx;
-            cur_alnmt = update_alnmt(group1, group2, gap_pos);
+            TRACE_START(update_start);
+            if (windowed)
+                cur_alnmt = update_alnmt_window(group1, group2, win_start, win_end, gap_pos);
+            else
+                cur_alnmt = update_alnmt(group1, group2, gap_pos);
+            if (opts.refine)
+                update_stamps(refine, prev_path, gap_pos, win_start, win_end, glbl_idx);
+            TRACE_END(TRACE_UPDATE, update_start);
             accept_reject_chain += 'A';
         } else {
             accept_reject_chain += 'R';
         }
 
         glbl_idx++;
+
+        // Periodically checkpoint in the background
+        if (!opts.checkpoint_filename.empty() && TIME_SEC(last_ckpt_time, CLOCK_NOW) >= opts.checkpoint_interval) {
+            bm_checkpoint_t ckpt{opts.random_mode, opts.partn_kind, glbl_idx, best_glbl_idx, best_score, glbl_idx, rate, accept_reject_chain, cur_alnmt, opts.refine ? refine.col_stamp : std::vector<int>{}};
+            write_checkpoint_async(ckpt_writer, opts.checkpoint_filename, ckpt);
+            last_ckpt_time = CLOCK_NOW;
+        }
     }
+    wait_checkpoint(ckpt_writer);
     const auto loop_end = CLOCK_NOW;
     const double loop_runtime = TIME_SEC(loop_start, loop_end);
-    const double avg_iter_runtime = loop_runtime / static_cast<double>(glbl_idx);
+    const double avg_iter_runtime = loop_runtime / static_cast<double>(glbl_idx - first_glbl_idx);
+
+    if (trace_buf.enabled) {
+        std::vector<std::vector<trace_event_t>> rank_events{trace_events()};
+        if (write_chrome_trace(opts.trace_filename, rank_events))
+            std::cout << "Trace: " << opts.trace_filename << " (" << rank_events[0].size() << " events, " << trace_buf.num_recorded - rank_events[0].size() << " overwritten)\n";
+        else
+            std::cerr << "Unable to write trace: " << opts.trace_filename << ".\n";
+    }
 
     const auto end_time = CLOCK_NOW;
     const double runtime = TIME_SEC(start_time, end_time);
 
+    metrics_report_t metrics{};
+    metrics.program = "bm_seq";
+    metrics.num_iters = glbl_idx;
+    metrics.num_steps = glbl_idx - first_glbl_idx;
+    metrics.best_score = best_score;
+    metrics.runtime = runtime;
+    metrics.loop_runtime = loop_runtime;
+    metrics.candidates = glbl_idx - first_glbl_idx;
+    metrics.discarded = 0;
+    metrics.accept_reject_chain = accept_reject_chain;
+    metrics.rank_cells = {dp_stats.cells - init_cells};
+    metrics.rank_loop_sec = {loop_runtime};
+    metrics.rank_comm_bytes = {0};
+    const std::string metrics_file = metrics_filename(opts.output_filename);
+    if (!write_metrics(metrics_file, metrics))
+        std::cerr << "Unable to write metrics: " << metrics_file << ".\n";
+
+    // Near-duplicates differ from their representative, so the expanded
+    // alignment has its own score
+    seq_group_t out_alnmt = expand_alnmt(cur_alnmt, fasta_recs, unique_of);
+    int expanded_score = best_score;
+    if (opts.dedup_mode == DEDUP_NEAR)
+        expanded_score = alnmt_score(out_alnmt, params);
+
     std::cout << "Ran for " << glbl_idx << " iterations.\n";
+    std::cout << "Stopped by: " << stop_reason_name(stop_reason) << "\n";
     std::cout << "Runtime (sec): " << runtime << "\n";
     std::cout << "Runtime per iteration (sec): " << avg_iter_runtime << "\n";
+    std::cout << "DP cells computed: " << dp_stats.cells << " of " << dp_stats.full_cells << " (" << 100.0 * dp_stats.cells / dp_stats.full_cells << "%), band regrows: " << dp_stats.band_regrows << ", full fallbacks: " << dp_stats.full_fallbacks << "\n";
+    if (opts.anchored)
+        std::cout << "Anchored alignments: " << dp_stats.anchored_alnmts << ", anchor columns: " << dp_stats.anchor_cols << "\n";
+    if (opts.anchor_check)
+        std::cout << "Anchor check: " << dp_stats.anchor_checks << " alignments, mean score loss " << static_cast<double>(dp_stats.anchor_loss) / dp_stats.anchor_checks << ", worse in " << dp_stats.anchor_worse << "\n";
+    if (opts.refine)
+        std::cout << "Refinement: " << num_windowed << " windowed, " << glbl_idx - first_glbl_idx - num_windowed << " full passes\n";
+    std::cout << "Partition family: " << partn_family_name(opts.partn_kind) << " (window " << num_partns << ")\n";
+    std::cout << "Initial alignment: " << init_name << " (score = " << init_score << ", " << init_runtime << " sec)\n";
+    if (opts.autotune)
+        std::cout << "Kernel: " << kernel_name(kernel_config.kind) << " (tile " << kernel_config.tile << "), " << (tuned.cached ? "cached" : "tuned") << " in " << tuned.tune_sec << " sec\n";
+    std::cout << "Unique sequences: " << unique_recs.size() << " of " << fasta_recs.size() << " (dedup " << dedup_mode_name(opts.dedup_mode) << ")\n";
     std::cout << "Alignment score: " << best_score << "\n";
+    if (opts.dedup_mode == DEDUP_NEAR)
+        std::cout << "Expanded alignment score: " << expanded_score << "\n";
     std::cout << "Accepts and rejects: " << accept_reject_chain << "\n";
+    std::cout << "Metrics: " << metrics_file << "\n";
 
-    std::ofstream fout(output_filename);
+    std::ofstream fout(opts.output_filename);
 
     fout << "Ran for " << glbl_idx << " iterations.\n";
+    fout << "Stopped by: " << stop_reason_name(stop_reason) << "\n";
     fout << "Runtime (sec): " << runtime << "\n";
     fout << "Runtime per iteration (sec): " << avg_iter_runtime << "\n";
+    fout << "DP cells computed: " << dp_stats.cells << " of " << dp_stats.full_cells << " (" << 100.0 * dp_stats.cells / dp_stats.full_cells << "%), band regrows: " << dp_stats.band_regrows << ", full fallbacks: " << dp_stats.full_fallbacks << "\n";
+    if (opts.anchored)
+        fout << "Anchored alignments: " << dp_stats.anchored_alnmts << ", anchor columns: " << dp_stats.anchor_cols << "\n";
+    if (opts.anchor_check)
+        fout << "Anchor check: " << dp_stats.anchor_checks << " alignments, mean score loss " << static_cast<double>(dp_stats.anchor_loss) / dp_stats.anchor_checks << ", worse in " << dp_stats.anchor_worse << "\n";
+    if (opts.refine)
+        fout << "Refinement: " << num_windowed << " windowed, " << glbl_idx - first_glbl_idx - num_windowed << " full passes\n";
+    fout << "Partition family: " << partn_family_name(opts.partn_kind) << " (window " << num_partns << ")\n";
+    fout << "Initial alignment: " << init_name << " (score = " << init_score << ", " << init_runtime << " sec)\n";
+    if (opts.autotune)
+        fout << "Kernel: " << kernel_name(kernel_config.kind) << " (tile " << kernel_config.tile << "), " << (tuned.cached ? "cached" : "tuned") << " in " << tuned.tune_sec << " sec\n";
+    fout << "Unique sequences: " << unique_recs.size() << " of " << fasta_recs.size() << " (dedup " << dedup_mode_name(opts.dedup_mode) << ")\n";
     fout << "Alignment score: " << best_score << "\n";
+    if (opts.dedup_mode == DEDUP_NEAR)
+        fout << "Expanded alignment score: " << expanded_score << "\n";
     fout << "Accepts and rejects: " << accept_reject_chain << "\n";
 
     fout << "Final alignment (score = " << best_score << "):\n";
     fout << "\n\n";
-    for (seq_t seq : cur_alnmt) {
+    for (seq_t seq : out_alnmt) {
         fout << "seq " << std::setw(3) << seq.id << ": ";
         fout << seq.data << "\n";
     }
+
+    unmap_fasta(fasta_map);
 }
@@ -1,23 +1,30 @@
 #include "bm_utils.h"
 #include "align.h"
+#include "guide_tree.h"
 #include "parse_fasta.h"
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstdlib>
+#include <iostream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <random>
 
-seq_group_t naiive_alnmt(std::vector<fasta_seq_t> fasta_seqs) {
+seq_group_t naiive_alnmt(const std::vector<fasta_rec_t>& fasta_recs) {
     seq_group_t naiive_alnmt{};
     size_t longest = 0;
-    for (size_t i = 0; i < fasta_seqs.size(); i++) {
+    for (size_t i = 0; i < fasta_recs.size(); i++) {
         seq_t seq;
         seq.id = i;
-        seq.data = fasta_seqs[i].seq;
+        seq.data = fasta_recs[i].seq;
         naiive_alnmt.push_back(seq);
 
-        if (fasta_seqs[i].seq.size() > longest) {
-            longest = fasta_seqs[i].seq.size();
+        if (fasta_recs[i].seq.size() > longest) {
+            longest = fasta_recs[i].seq.size();
         }
 
     }
@@ -31,23 +38,227 @@ seq_group_t naiive_alnmt(std::vector<fasta_seq_t> fasta_seqs) {
     return naiive_alnmt;
 }
 
-void select_partn(seq_group_t seqs, int glbl_idx, int random_mode, seq_group_t& group1, seq_group_t& group2) {
-    assert(random_mode == DEVICERANDOM || random_mode == PSEUDORANDOM);
+void collapse_fasta_recs(const std::vector<fasta_rec_t>& fasta_recs, int dedup_mode, double identity,
+                         std::vector<fasta_rec_t>& unique_recs, std::vector<int>& weights, std::vector<int>& unique_of) {
+    unique_recs.clear();
+    weights.clear();
+    unique_of.assign(fasta_recs.size(), -1);
 
-    int num_seqs = seqs.size();
+    // Representatives by sequence, and by length for near-duplicates
+    std::unordered_map<std::string_view, int> exact{};
+    std::unordered_map<size_t, std::vector<int>> by_len{};
+    for (size_t i = 0; i < fasta_recs.size(); i++) {
+        std::string_view seq = fasta_recs[i].seq;
+        int unique = -1;
+
+        if (dedup_mode != DEDUP_OFF) {
+            auto found = exact.find(seq);
+            if (found != exact.end())
+                unique = found->second;
+        }
+
+        if (unique == -1 && dedup_mode == DEDUP_NEAR && !seq.empty()) {
+            size_t min_same = static_cast<size_t>(identity * seq.size() + 0.999999);
+            for (int candidate : by_len[seq.size()]) {
+                std::string_view rep = unique_recs[candidate].seq;
+                size_t same = 0;
+                for (size_t k = 0; k < seq.size(); k++)
+                    same += seq[k] == rep[k];
+                if (same >= min_same) {
+                    unique = candidate;
+                    break;
+                }
+            }
+        }
+
+        if (unique == -1) {
+            unique = unique_recs.size();
+            unique_recs.push_back(fasta_recs[i]);
+            weights.push_back(0);
+            exact.emplace(seq, unique);
+            if (dedup_mode == DEDUP_NEAR)
+                by_len[seq.size()].push_back(unique);
+        }
+        weights[unique]++;
+        unique_of[i] = unique;
+    }
+
+    // Berger-Munson needs at least two rows to partition
+    if (unique_recs.size() < 2 && fasta_recs.size() >= 2)
+        collapse_fasta_recs(fasta_recs, DEDUP_OFF, identity, unique_recs, weights, unique_of);
+}
+
+seq_group_t expand_alnmt(const seq_group_t& alnmt, const std::vector<fasta_rec_t>& fasta_recs, const std::vector<int>& unique_of) {
+    std::vector<const seq_t *> rows(alnmt.size());
+    for (const seq_t& seq : alnmt)
+        rows[seq.id] = &seq;
+
+    seq_group_t expanded(fasta_recs.size());
+    for (size_t i = 0; i < fasta_recs.size(); i++) {
+        const std::string& rep_data = rows[unique_of[i]]->data;
+        std::string_view residues = fasta_recs[i].seq;
+
+        expanded[i].id = i;
+        expanded[i].data = rep_data;
+        size_t k = 0;
+        for (char& c : expanded[i].data) {
+            if (c != '-' && k < residues.size())
+                c = residues[k++];
+        }
+    }
+    return expanded;
+}
+
+const char *dedup_mode_name(int dedup_mode) {
+    if (dedup_mode == DEDUP_EXACT)
+        return "exact";
+    else if (dedup_mode == DEDUP_NEAR)
+        return "near";
+    return "off";
+}
+
+// Binomial coefficient C(n, k), or cap + 1 if it is larger than cap.
+static long long binom_capped(int n, int k, long long cap) {
+    if (k < 0 || k > n)
+        return 0;
+    long long result = 1;
+    for (int i = 1; i <= k; i++) {
+        // result is C(n - k + i - 1, i - 1), so the division is exact
+        result = result * (n - k + i) / i;
+        if (result > cap)
+            return cap + 1;
+    }
+    return result;
+}
+
+partn_family_t make_partn_family(int kind, const std::vector<fasta_rec_t>& fasta_recs) {
+    assert(kind == PARTN_SMALL || kind == PARTN_TREE || kind == PARTN_BALANCED);
+
+    int num_seqs = fasta_recs.size();
+    if (num_seqs < 2) {
+        std::cerr << "At least 2 sequences are needed to partition, got " << num_seqs << ".\n";
+        exit(EXIT_FAILURE);
+    }
+
+    partn_family_t family{};
+    family.kind = kind;
+
+    if (kind == PARTN_SMALL) {
+        family.num_partns = num_seqs + (num_seqs * (num_seqs - 1)) / 2;
+    } else if (kind == PARTN_TREE) {
+        std::vector<double> dists{};
+        kmer_dists(fasta_recs, 0, 1, dists);
+        guide_tree_t tree = upgma_tree(dists, num_seqs);
+
+        // Leaves under each node, children before parents
+        std::vector<std::vector<int>> leaves(tree.size());
+        for (size_t node = 0; node < tree.size(); node++) {
+            if (tree[node].left == -1) {
+                leaves[node].push_back(node);
+            } else {
+                leaves[node] = leaves[tree[node].left];
+                leaves[node].insert(leaves[node].end(), leaves[tree[node].right].begin(), leaves[tree[node].right].end());
+                std::sort(leaves[node].begin(), leaves[node].end());
+            }
+        }
+
+        // Every edge is above a non-root node. Both edges below the root give
+        // the same split, so the root's right child is skipped.
+        int root = tree.size() - 1;
+        for (int node = 0; node < root; node++) {
+            if (node != tree[root].right)
+                family.splits.push_back(leaves[node]);
+        }
+        family.num_partns = family.splits.size();
+    } else if (kind == PARTN_BALANCED) {
+        // An even count's halves are counted once, by fixing sequence 0 in
+        // group1
+        int half = num_seqs / 2;
+        long long count = num_seqs % 2 == 0 ? binom_capped(num_seqs - 1, half - 1, INT_MAX)
+                                            : binom_capped(num_seqs, half, INT_MAX);
+        family.num_splits = count > INT_MAX ? 0 : static_cast<int>(count);
+        family.num_partns = static_cast<int>(std::min<long long>(count, BALANCED_MAX_WINDOW));
+    }
+
+    return family;
+}
+
+const char *partn_family_name(int kind) {
+    if (kind == PARTN_TREE)
+        return "tree";
+    else if (kind == PARTN_BALANCED)
+        return "balanced";
+    return "small";
+}
+
+int select_partn(seq_group_t& seqs, int island_id, int glbl_idx, int random_mode, partn_family_t& family, seq_group_t& group1, seq_group_t& group2) {
+    assert(random_mode == DEVICERANDOM || random_mode == PSEUDORANDOM);
 
     std::mt19937 gen{};
     if (random_mode == DEVICERANDOM) {
         std::random_device rd;
         gen.seed(rd());
-    } else if (random_mode == PSEUDORANDOM) {
+    } else if (random_mode == PSEUDORANDOM && island_id == 0) {
         gen.seed(glbl_idx);
+    } else if (random_mode == PSEUDORANDOM) {
+        std::seed_seq seq{island_id, glbl_idx};
+        gen.seed(seq);
     }
 
-    int num_partns = num_seqs + (num_seqs * (num_seqs - 1)) / 2;
-    std::uniform_int_distribution<> distr(0, num_partns - 1);
+    int max_partn_num = family.num_partns - 1;
+    if (family.kind == PARTN_BALANCED)
+        max_partn_num = family.num_splits > 0 ? family.num_splits - 1 : INT_MAX;
+    std::uniform_int_distribution<> distr(0, max_partn_num);
 
     int partn_num = distr(gen);
+    build_partn(seqs, partn_num, family, group1, group2);
+    return partn_num;
+}
+
+void build_partn(seq_group_t& seqs, int partn_num, partn_family_t& family, seq_group_t& group1, seq_group_t& group2) {
+    int num_seqs = seqs.size();
+
+    if (family.kind == PARTN_TREE || family.kind == PARTN_BALANCED) {
+        std::vector<bool> in_group1(num_seqs, false);
+        if (family.kind == PARTN_TREE) {
+            for (int i : family.splits[partn_num])
+                in_group1[i] = true;
+        } else if (family.num_splits > 0) {
+            // Unrank the partition number as a combination, in colexicographic
+            // order, of the sequences after the fixed one (if any)
+            int first = 0;
+            int size = num_seqs / 2;
+            if (num_seqs % 2 == 0) {
+                in_group1[0] = true;
+                first = 1;
+                size--;
+            }
+            long long rank = partn_num;
+            for (int k = size; k > 0; k--) {
+                int c = k - 1;
+                while (binom_capped(c + 1, k, INT_MAX) <= rank)
+                    c++;
+                in_group1[first + c] = true;
+                rank -= binom_capped(c, k, INT_MAX);
+            }
+        } else {
+            std::vector<int> order(num_seqs);
+            for (int i = 0; i < num_seqs; i++)
+                order[i] = i;
+            std::mt19937 shuffle_gen(partn_num);
+            std::shuffle(order.begin(), order.end(), shuffle_gen);
+            for (int i = 0; i < num_seqs / 2; i++)
+                in_group1[order[i]] = true;
+        }
+
+        for (int i = 0; i < num_seqs; i++) {
+            if (in_group1[i])
+                group1.push_back(seqs[i]);
+            else
+                group2.push_back(seqs[i]);
+        }
+        return;
+    }
 
     if (partn_num < num_seqs) {
         // group1 has 1 sequence
@@ -75,6 +286,33 @@ void select_partn(seq_group_t seqs, int glbl_idx, int random_mode, seq_group_t&
     }
 }
 
+int check_budget(int max_iters, double min_rate, int rate_window_len, int glbl_idx, int best_score, rate_window_t& rate) {
+    if (max_iters > 0 && glbl_idx >= max_iters)
+        return STOP_MAX_ITERS;
+
+    if (min_rate > 0.0 && glbl_idx - rate.start_idx >= rate_window_len) {
+        double improve_rate = (static_cast<double>(best_score) - rate.start_score) / (glbl_idx - rate.start_idx);
+        if (improve_rate < min_rate)
+            return STOP_MIN_RATE;
+        rate.start_idx = glbl_idx;
+        rate.start_score = best_score;
+    }
+
+    return STOP_NONE;
+}
+
+const char *stop_reason_name(int stop_reason) {
+    if (stop_reason == STOP_CONVERGED)
+        return "converged";
+    else if (stop_reason == STOP_MIN_RATE)
+        return "improvement rate below threshold";
+    else if (stop_reason == STOP_MAX_ITERS)
+        return "iteration limit";
+    else if (stop_reason == STOP_TIME_LIMIT)
+        return "time limit";
+    return "running";
+}
+
 void remove_glbl_gaps(seq_group_t& group) {
     size_t seq_len = group[0].data.size();
 
@@ -96,3 +334,10 @@ void remove_glbl_gaps(seq_group_t& group) {
 
     return;
 }
+
+seq_group_t slice_group(const seq_group_t& group, int start, int end) {
+    seq_group_t slice = group;
+    for (seq_t& seq : slice)
+        seq.data = seq.data.substr(start, end - start);
+    return slice;
+}
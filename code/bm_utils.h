@@ -18,24 +18,145 @@
 #define DEVICERANDOM 1
 #define PSEUDORANDOM 2
 
+#define INIT_NAIIVE 1
+#define INIT_GUIDE_TREE 2
+
+#define PARTN_SMALL 1
+#define PARTN_TREE 2
+#define PARTN_BALANCED 3
+
+#define DEDUP_OFF 0
+#define DEDUP_EXACT 1
+#define DEDUP_NEAR 2
+
+#define INPUT_BCAST 1
+#define INPUT_MPIIO 2
+
+#define STOP_NONE 0
+#define STOP_CONVERGED 1
+#define STOP_MIN_RATE 2
+#define STOP_MAX_ITERS 3
+#define STOP_TIME_LIMIT 4
+
+/**
+ * Largest convergence window of the balanced family. Beyond about 12
+ * sequences there are more balanced splits than this, and the run stops after
+ * this many consecutive rejections without having drawn every split.
+ */
+#define BALANCED_MAX_WINDOW 1024
+
 #define CLOCK_NOW (std::chrono::steady_clock::now())
 #define TIME_SEC(START, END) (std::chrono::duration_cast<std::chrono::duration<double>>((END) - (START)).count())
 
 /**
  * Constructs a naiive alignment by adding gaps to the end.
  */
-seq_group_t naiive_alnmt(std::vector<fasta_seq_t> fasta_seqs);
+seq_group_t naiive_alnmt(const std::vector<fasta_rec_t>& fasta_recs);
+
+/**
+ * Collapses duplicate input sequences into one representative each (the
+ * first occurrence). With DEDUP_NEAR, sequences whose length equals a
+ * representative's and whose fraction of identical positions is at least
+ * identity are also collapsed into it. With DEDUP_OFF, or if fewer than two
+ * representatives would remain, nothing is collapsed.
+ *
+ * @param unique_recs Set to the representatives, in input order.
+ * @param weights Set to the number of input sequences each representative
+ *                stands for.
+ * @param unique_of Set to the representative (index in unique_recs) of each
+ *                  input sequence.
+ */
+void collapse_fasta_recs(const std::vector<fasta_rec_t>& fasta_recs, int dedup_mode, double identity,
+                         std::vector<fasta_rec_t>& unique_recs, std::vector<int>& weights, std::vector<int>& unique_of);
+
+/**
+ * Expands an alignment of representatives (row ids index unique_recs) into an
+ * alignment of every input sequence, with sequence i having id i. Each input
+ * sequence takes its representative's gaps, with its own residues in the
+ * remaining positions.
+ */
+seq_group_t expand_alnmt(const seq_group_t& alnmt, const std::vector<fasta_rec_t>& fasta_recs, const std::vector<int>& unique_of);
+
+/**
+ * Returns the name of a DEDUP_* mode.
+ */
+const char *dedup_mode_name(int dedup_mode);
+
+/**
+ * Represents the family that partitions are drawn from. A partition is
+ * identified by a single partition number within its family.
+ *
+ * PARTN_SMALL splits off one or two sequences (numbers 0 to num_partns - 1).
+ * PARTN_TREE splits along an edge of a k-mer UPGMA guide tree (numbers index
+ * splits). PARTN_BALANCED splits into two halves, group1 taking the smaller
+ * half and, for an even count, sequence 0 (numbers 0 to num_splits - 1 index
+ * the halves in colexicographic order; when there are more than INT_MAX, numbers
+ * instead seed a shuffle and range over all non-negative ints).
+ */
+typedef struct partn_family {
+    int kind;
+    int num_partns; // Consecutive rejections needed for convergence
+    int num_splits; // PARTN_BALANCED: splits indexed, 0 if too many to index
+    std::vector<std::vector<int>> splits; // PARTN_TREE: group1 ids of each edge
+} partn_family_t;
+
+/**
+ * Constructs a partition family of the given kind over the input sequences.
+ * Exits with an error if there are fewer than 2 sequences.
+ */
+partn_family_t make_partn_family(int kind, const std::vector<fasta_rec_t>& fasta_recs);
+
+/**
+ * Name of a partition family kind, for output.
+ */
+const char *partn_family_name(int kind);
 
 /**
  * Randomly (or pseudorandomly) selects a partition of the sequence.
+ * Pseudorandom partitions depend on the island and the global index; island
+ * 0 draws the same sequence as a single chain.
  *
  * Constructs the partition into group1 and group2.
+ * @return Partition number of the selected partition.
+ */
+int select_partn(seq_group_t& seqs, int island_id, int glbl_idx, int random_mode, partn_family_t& family, seq_group_t& group1, seq_group_t& group2);
+
+/**
+ * Constructs the partition with the given partition number into group1 and
+ * group2.
+ */
+void build_partn(seq_group_t& seqs, int partn_num, partn_family_t& family, seq_group_t& group1, seq_group_t& group2);
+
+/**
+ * Start of the window the score improvement rate is measured over.
+ */
+typedef struct rate_window {
+    int start_idx;
+    int start_score;
+} rate_window_t;
+
+/**
+ * Checks the iteration and improvement rate budgets (0 disables either), and
+ * moves the rate window forward once it is full. Both checks depend only on
+ * the Berger-Munson state, so every processor agrees on the result.
+ *
+ * @return STOP_MAX_ITERS, STOP_MIN_RATE, or STOP_NONE.
  */
-void select_partn(seq_group_t seqs, int glbl_idx, int random_mode, seq_group_t& group1, seq_group_t& group2);
+int check_budget(int max_iters, double min_rate, int rate_window_len, int glbl_idx, int best_score, rate_window_t& rate);
+
+/**
+ * Describes why the Berger-Munson loop stopped, for output.
+ */
+const char *stop_reason_name(int stop_reason);
 
 /**
  * Removes global gaps (gaps that exist in every sequence of a group).
  */
 void remove_glbl_gaps(seq_group_t& group);
 
+/**
+ * Copies columns [start, end) of every sequence of a group.
+ */
+seq_group_t slice_group(const seq_group_t& group, int start, int end);
+
 #endif
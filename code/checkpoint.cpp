@@ -0,0 +1,149 @@
+#include "checkpoint.h"
+#include "align.h"
+#include "bm_utils.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// File layout, all integers int32 in host byte order:
+//   magic, version, random_mode, partn_kind, glbl_idx, best_glbl_idx,
+//   best_score, par_step, rate.start_idx, rate.start_score,
+//   chain length, chain bytes,
+//   number of sequences, alignment length, then per sequence: id, bytes,
+//   number of column stamps, stamps.
+#define CHECKPOINT_MAGIC 0x4b434d42 // "BMCK"
+#define CHECKPOINT_VERSION 2
+
+static void put_int(std::ofstream& fout, int32_t value) {
+    fout.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static bool get_int(std::ifstream& fin, int32_t& value) {
+    fin.read(reinterpret_cast<char *>(&value), sizeof(value));
+    return static_cast<bool>(fin);
+}
+
+bool write_checkpoint(const std::string& filename, const bm_checkpoint_t& ckpt) {
+    std::string tmp_filename = filename + ".tmp";
+    std::ofstream fout(tmp_filename, std::ios::binary | std::ios::trunc);
+    if (!fout) {
+        std::cerr << "Unable to write checkpoint: " << tmp_filename << ".\n";
+        return false;
+    }
+
+    put_int(fout, CHECKPOINT_MAGIC);
+    put_int(fout, CHECKPOINT_VERSION);
+    put_int(fout, ckpt.random_mode);
+    put_int(fout, ckpt.partn_kind);
+    put_int(fout, ckpt.glbl_idx);
+    put_int(fout, ckpt.best_glbl_idx);
+    put_int(fout, ckpt.best_score);
+    put_int(fout, ckpt.par_step);
+    put_int(fout, ckpt.rate.start_idx);
+    put_int(fout, ckpt.rate.start_score);
+
+    put_int(fout, ckpt.accept_reject_chain.size());
+    fout.write(ckpt.accept_reject_chain.data(), ckpt.accept_reject_chain.size());
+
+    int32_t alnmt_len = ckpt.cur_alnmt.empty() ? 0 : ckpt.cur_alnmt[0].data.size();
+    put_int(fout, ckpt.cur_alnmt.size());
+    put_int(fout, alnmt_len);
+    for (const seq_t& seq : ckpt.cur_alnmt) {
+        put_int(fout, seq.id);
+        fout.write(seq.data.data(), alnmt_len);
+    }
+
+    put_int(fout, ckpt.col_stamp.size());
+    for (int stamp : ckpt.col_stamp)
+        put_int(fout, stamp);
+
+    fout.close();
+    if (!fout) {
+        std::cerr << "Unable to write checkpoint: " << tmp_filename << ".\n";
+        return false;
+    }
+
+    return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
+
+bool read_checkpoint(const std::string& filename, bm_checkpoint_t& ckpt) {
+    std::ifstream fin(filename, std::ios::binary);
+    if (!fin)
+        return false;
+
+    int32_t magic;
+    int32_t version;
+    if (!get_int(fin, magic) || magic != CHECKPOINT_MAGIC)
+        return false;
+    if (!get_int(fin, version) || version != CHECKPOINT_VERSION)
+        return false;
+
+    int32_t fields[8];
+    for (int k = 0; k < 8; k++) {
+        if (!get_int(fin, fields[k]))
+            return false;
+    }
+    ckpt.random_mode = fields[0];
+    ckpt.partn_kind = fields[1];
+    ckpt.glbl_idx = fields[2];
+    ckpt.best_glbl_idx = fields[3];
+    ckpt.best_score = fields[4];
+    ckpt.par_step = fields[5];
+    ckpt.rate.start_idx = fields[6];
+    ckpt.rate.start_score = fields[7];
+
+    int32_t chain_len;
+    if (!get_int(fin, chain_len) || chain_len < 0)
+        return false;
+    ckpt.accept_reject_chain.resize(chain_len);
+    fin.read(&ckpt.accept_reject_chain[0], chain_len);
+
+    int32_t num_seqs;
+    int32_t alnmt_len;
+    if (!get_int(fin, num_seqs) || !get_int(fin, alnmt_len) || num_seqs < 0 || alnmt_len < 0)
+        return false;
+    ckpt.cur_alnmt.resize(num_seqs);
+    for (seq_t& seq : ckpt.cur_alnmt) {
+        int32_t id;
+        if (!get_int(fin, id))
+            return false;
+        seq.id = id;
+        seq.data.resize(alnmt_len);
+        fin.read(&seq.data[0], alnmt_len);
+    }
+
+    int32_t num_stamps;
+    if (!get_int(fin, num_stamps) || num_stamps < 0)
+        return false;
+    ckpt.col_stamp.resize(num_stamps);
+    for (int& stamp : ckpt.col_stamp) {
+        int32_t value;
+        if (!get_int(fin, value))
+            return false;
+        stamp = value;
+    }
+
+    return static_cast<bool>(fin);
+}
+
+void write_checkpoint_async(checkpoint_writer_t& writer, const std::string& filename, bm_checkpoint_t& ckpt) {
+    wait_checkpoint(writer);
+    if (writer.sync) {
+        write_checkpoint(filename, ckpt);
+        return;
+    }
+    writer.thread = std::thread([filename, snapshot = std::move(ckpt)]() {
+        write_checkpoint(filename, snapshot);
+    });
+}
+
+void wait_checkpoint(checkpoint_writer_t& writer) {
+    if (writer.thread.joinable())
+        writer.thread.join();
+}
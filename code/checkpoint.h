@@ -0,0 +1,71 @@
+/** @file checkpoint.h
+ *  Checkpoint and restart of Berger-Munson iteration state.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include "align.h"
+#include "bm_utils.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Represents the state of the Berger-Munson loop between two (parallel)
+ * steps. Resuming from it under pseudorandom mode continues the same chain.
+ */
+typedef struct bm_checkpoint {
+    int random_mode;
+    int partn_kind;
+    int glbl_idx;
+    int best_glbl_idx;
+    int best_score;
+    int par_step;
+    rate_window_t rate;
+    std::string accept_reject_chain;
+    seq_group_t cur_alnmt;
+    std::vector<int> col_stamp; // Change stamps of --refine, empty without it
+} bm_checkpoint_t;
+
+/**
+ * Writes checkpoints in the background, one at a time, or on the calling
+ * thread if sync is set.
+ */
+typedef struct checkpoint_writer {
+    std::thread thread;
+    bool sync = false;
+} checkpoint_writer_t;
+
+/**
+ * Writes a checkpoint to a binary file. The file is written under a
+ * temporary name and renamed, so an interrupted write leaves the previous
+ * checkpoint intact.
+ *
+ * @return Whether the file was written.
+ */
+bool write_checkpoint(const std::string& filename, const bm_checkpoint_t& ckpt);
+
+/**
+ * Reads a checkpoint written by write_checkpoint.
+ *
+ * @return Whether a valid checkpoint was read.
+ */
+bool read_checkpoint(const std::string& filename, bm_checkpoint_t& ckpt);
+
+/**
+ * Starts writing a checkpoint on a background thread, after waiting for the
+ * writer's previous checkpoint (if any) to finish. A sync writer writes it
+ * before returning instead. ckpt is moved from.
+ */
+void write_checkpoint_async(checkpoint_writer_t& writer, const std::string& filename, bm_checkpoint_t& ckpt);
+
+/**
+ * Waits for the writer's checkpoint (if any) to finish.
+ */
+void wait_checkpoint(checkpoint_writer_t& writer);
+
+#endif
@@ -0,0 +1,105 @@
+/** @file fasta_bench.cpp
+ *  Compares the throughput of parse_fasta and map_fasta on a FASTA file.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#include "bm_utils.h"
+#include "parse_fasta.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+// Prints the best of several runs, as MB/s and records/s.
+static void report(const char *name, double best_sec, size_t file_size, size_t num_recs) {
+    std::cout << name << ": " << best_sec << " sec, "
+              << file_size / best_sec / 1e6 << " MB/s, "
+              << num_recs / best_sec << " records/s\n";
+}
+
+int main(int argc, char *argv[]) {
+    std::string input_filename = "";
+    int num_runs = 5;
+    int num_threads = std::thread::hardware_concurrency();
+
+    int opt;
+    while((opt = getopt(argc, argv, "i:n:j:")) != -1) {
+        switch (opt) {
+            case 'i':
+                input_filename = optarg;
+                break;
+            case 'n':
+                num_runs = atoi(optarg);
+                break;
+            case 'j':
+                num_threads = atoi(optarg);
+                break;
+        default:
+            std::cerr << "Usage: " << argv[0] << " -i input_filename [-n num_runs] [-j num_threads]\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (input_filename.empty() || num_runs < 1) {
+        std::cerr << "Usage: " << argv[0] << " -i input_filename [-n num_runs] [-j num_threads]\n";
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat st;
+    if (stat(input_filename.c_str(), &st) != 0) {
+        std::cerr << "Unable to open file: " << input_filename << ".\n";
+        exit(EXIT_FAILURE);
+    }
+    size_t file_size = st.st_size;
+
+    std::cout << "Input file: " << input_filename << " (" << file_size << " bytes)\n";
+    std::cout << "Runs: " << num_runs << ", threads: " << num_threads << "\n";
+
+    double parse_best = 0.0;
+    std::vector<fasta_seq_t> fasta_seqs{};
+    for (int run = 0; run < num_runs; run++) {
+        const auto start = CLOCK_NOW;
+        fasta_seqs = parse_fasta(input_filename);
+        double sec = TIME_SEC(start, CLOCK_NOW);
+        if (run == 0 || sec < parse_best)
+            parse_best = sec;
+    }
+
+    double map_best = 0.0;
+    for (int run = 0; run < num_runs; run++) {
+        const auto start = CLOCK_NOW;
+        fasta_map_t fasta_map{};
+        map_fasta(input_filename, num_threads, fasta_map);
+        double sec = TIME_SEC(start, CLOCK_NOW);
+        if (run == 0 || sec < map_best)
+            map_best = sec;
+
+        // Both parsers must agree on every record (map_fasta also strips
+        // carriage returns, so CRLF files are reported as different)
+        if (run == 0) {
+            bool same = fasta_map.recs.size() == fasta_seqs.size();
+            for (size_t i = 0; same && i < fasta_seqs.size(); i++) {
+                same = fasta_map.recs[i].ident == fasta_seqs[i].ident
+                       && fasta_map.recs[i].desc == fasta_seqs[i].desc
+                       && fasta_map.recs[i].seq == fasta_seqs[i].seq;
+            }
+            if (!same) {
+                std::cerr << "map_fasta and parse_fasta disagree.\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+        unmap_fasta(fasta_map);
+    }
+
+    std::cout << "Records: " << fasta_seqs.size() << "\n";
+    report("parse_fasta", parse_best, file_size, fasta_seqs.size());
+    report("map_fasta", map_best, file_size, fasta_seqs.size());
+    std::cout << "Speedup: " << parse_best / map_best << "x\n";
+}
@@ -0,0 +1,166 @@
+/** @file gen_msa.cpp
+ *  Generates synthetic sequence families for benchmarking: a random root
+ *  sequence evolves along a random binary tree, with substitutions and
+ *  indels, and the leaves are written as a FASTA file.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+/**
+ * Residues per line of the output, as in data/demo.
+ */
+#define FASTA_LINE_LEN 50
+
+/**
+ * Mean length of an insertion or deletion.
+ */
+#define INDEL_MEAN_LEN 3
+
+/**
+ * Parameters of a generated family. Rates are per residue per unit of branch
+ * length; branch lengths are uniform in [0.5, 1.5].
+ */
+typedef struct gen_params {
+    int num_seqs = 16;
+    int seq_len = 300;
+    bool dna = false;
+    double sub_rate = 0.1;
+    double indel_rate = 0.01;
+    unsigned seed = 1;
+} gen_params_t;
+
+static const std::string protein_alphabet = "ACDEFGHIKLMNPQRSTVWY";
+static const std::string dna_alphabet = "ACGT";
+
+// Random residue of the family's alphabet.
+static char random_residue(const std::string& alphabet, std::mt19937& rng) {
+    std::uniform_int_distribution<size_t> pick(0, alphabet.size() - 1);
+    return alphabet[pick(rng)];
+}
+
+// Evolves a sequence along one branch.
+static std::string evolve(const std::string& parent, double branch_len, const gen_params_t& params,
+                          const std::string& alphabet, std::mt19937& rng) {
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    std::geometric_distribution<int> indel_len(1.0 / INDEL_MEAN_LEN);
+    double sub_prob = params.sub_rate * branch_len;
+    double indel_prob = params.indel_rate * branch_len;
+
+    std::string child{};
+    size_t i = 0;
+    while (i < parent.size()) {
+        // Insertions and deletions are equally likely
+        if (coin(rng) < indel_prob) {
+            int len = indel_len(rng) + 1;
+            if (coin(rng) < 0.5) {
+                for (int k = 0; k < len; k++)
+                    child += random_residue(alphabet, rng);
+            } else {
+                i += len;
+                continue;
+            }
+        }
+
+        child += coin(rng) < sub_prob ? random_residue(alphabet, rng) : parent[i];
+        i++;
+    }
+
+    // A sequence is never deleted entirely
+    if (child.empty())
+        child += random_residue(alphabet, rng);
+    return child;
+}
+
+// Evolves seq down a random tree over num_leaves leaves, appending the leaves.
+static void evolve_tree(const std::string& seq, int num_leaves, const gen_params_t& params, const std::string& alphabet,
+                        std::mt19937& rng, std::vector<std::string>& leaves) {
+    if (num_leaves == 1) {
+        leaves.push_back(seq);
+        return;
+    }
+
+    // Random split of the leaves between the two children
+    std::uniform_int_distribution<int> split(1, num_leaves - 1);
+    std::uniform_real_distribution<double> branch(0.5, 1.5);
+    int left = split(rng);
+    evolve_tree(evolve(seq, branch(rng), params, alphabet, rng), left, params, alphabet, rng, leaves);
+    evolve_tree(evolve(seq, branch(rng), params, alphabet, rng), num_leaves - left, params, alphabet, rng, leaves);
+}
+
+static void print_usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " -o output_filename [-n num_seqs] [-l seq_len] [-a P|D] [-s sub_rate] [-d indel_rate] [-r seed]\n";
+}
+
+int main(int argc, char *argv[]) {
+    gen_params_t params{};
+    std::string output_filename = "";
+
+    int opt;
+    while((opt = getopt(argc, argv, "o:n:l:a:s:d:r:")) != -1) {
+        switch (opt) {
+            case 'o':
+                output_filename = optarg;
+                break;
+            case 'n':
+                params.num_seqs = atoi(optarg);
+                break;
+            case 'l':
+                params.seq_len = atoi(optarg);
+                break;
+            case 'a':
+                if (std::string(optarg) != "P" && std::string(optarg) != "D") {
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                params.dna = optarg[0] == 'D';
+                break;
+            case 's':
+                params.sub_rate = atof(optarg);
+                break;
+            case 'd':
+                params.indel_rate = atof(optarg);
+                break;
+            case 'r':
+                params.seed = atoi(optarg);
+                break;
+        default:
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (output_filename.empty() || params.num_seqs < 2 || params.seq_len < 1 || params.sub_rate < 0.0 || params.indel_rate < 0.0) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const std::string& alphabet = params.dna ? dna_alphabet : protein_alphabet;
+    std::mt19937 rng(params.seed);
+
+    std::string root{};
+    for (int k = 0; k < params.seq_len; k++)
+        root += random_residue(alphabet, rng);
+
+    std::vector<std::string> leaves{};
+    evolve_tree(root, params.num_seqs, params, alphabet, rng, leaves);
+
+    std::ofstream fout(output_filename);
+    if (!fout) {
+        std::cerr << "Unable to open file: " << output_filename << ".\n";
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < leaves.size(); i++) {
+        fout << ">syn_" << i << " n=" << params.num_seqs << " l=" << params.seq_len << " seed=" << params.seed << "\n";
+        for (size_t pos = 0; pos < leaves[i].size(); pos += FASTA_LINE_LEN)
+            fout << leaves[i].substr(pos, FASTA_LINE_LEN) << "\n";
+    }
+}
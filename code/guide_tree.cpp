@@ -0,0 +1,217 @@
+#include "guide_tree.h"
+#include "align.h"
+#include "parse_fasta.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Sorted codes of every k-mer in a sequence (with repeats).
+static std::vector<uint64_t> kmer_codes(std::string_view seq) {
+    std::vector<uint64_t> codes{};
+    if (seq.size() < KMER_LEN)
+        return codes;
+
+    for (size_t i = 0; i + KMER_LEN <= seq.size(); i++) {
+        uint64_t code = 0;
+        for (size_t k = 0; k < KMER_LEN; k++)
+            code = (code << 8) | static_cast<unsigned char>(seq[i + k]);
+        codes.push_back(code);
+    }
+    std::sort(codes.begin(), codes.end());
+    return codes;
+}
+
+// Number of k-mers two sequences share, counting repeats at most as often as
+// they occur in both.
+static size_t shared_kmers(const std::vector<uint64_t>& codes1, const std::vector<uint64_t>& codes2) {
+    size_t shared = 0;
+    size_t a = 0;
+    size_t b = 0;
+    while (a < codes1.size() && b < codes2.size()) {
+        if (codes1[a] < codes2[b]) {
+            a++;
+        } else if (codes2[b] < codes1[a]) {
+            b++;
+        } else {
+            shared++;
+            a++;
+            b++;
+        }
+    }
+    return shared;
+}
+
+void kmer_dists(const std::vector<fasta_rec_t>& fasta_recs, int pid, int nproc, std::vector<double>& dists) {
+    int num_seqs = fasta_recs.size();
+    dists.assign(static_cast<size_t>(num_seqs) * num_seqs, 0.0);
+
+    std::vector<std::vector<uint64_t>> codes(num_seqs);
+    for (int i = 0; i < num_seqs; i++)
+        codes[i] = kmer_codes(fasta_recs[i].seq);
+
+    for (int i = pid; i < num_seqs; i += nproc) {
+        for (int j = i + 1; j < num_seqs; j++) {
+            // Fraction of the possible k-mers that are shared
+            size_t max_shared = std::min(codes[i].size(), codes[j].size());
+            double dist = 1.0;
+            if (max_shared > 0)
+                dist = 1.0 - static_cast<double>(shared_kmers(codes[i], codes[j])) / max_shared;
+            dists[static_cast<size_t>(i) * num_seqs + j] = dist;
+        }
+    }
+}
+
+guide_tree_t upgma_tree(const std::vector<double>& dists, int num_seqs) {
+    guide_tree_t tree{};
+    for (int i = 0; i < num_seqs; i++) {
+        tree_node_t leaf;
+        leaf.left = -1;
+        leaf.right = -1;
+        leaf.num_leaves = 1;
+        tree.push_back(leaf);
+    }
+
+    // Distances between active clusters, indexed by tree node
+    int num_nodes = 2 * num_seqs - 1;
+    std::vector<double> cluster_dists(static_cast<size_t>(num_nodes) * num_nodes, 0.0);
+    for (int i = 0; i < num_seqs; i++) {
+        for (int j = i + 1; j < num_seqs; j++) {
+            double dist = dists[static_cast<size_t>(i) * num_seqs + j];
+            cluster_dists[static_cast<size_t>(i) * num_nodes + j] = dist;
+            cluster_dists[static_cast<size_t>(j) * num_nodes + i] = dist;
+        }
+    }
+
+    std::vector<int> active{};
+    for (int i = 0; i < num_seqs; i++)
+        active.push_back(i);
+
+    while (active.size() > 1) {
+        // Find the closest pair of clusters
+        size_t best_a = 0;
+        size_t best_b = 1;
+        double best_dist = std::numeric_limits<double>::max();
+        for (size_t a = 0; a < active.size(); a++) {
+            for (size_t b = a + 1; b < active.size(); b++) {
+                double dist = cluster_dists[static_cast<size_t>(active[a]) * num_nodes + active[b]];
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best_a = a;
+                    best_b = b;
+                }
+            }
+        }
+
+        int left = active[best_a];
+        int right = active[best_b];
+        int merged = tree.size();
+
+        tree_node_t node;
+        node.left = left;
+        node.right = right;
+        node.num_leaves = tree[left].num_leaves + tree[right].num_leaves;
+        tree.push_back(node);
+
+        // Average linkage to every other cluster
+        for (int other : active) {
+            if (other == left || other == right)
+                continue;
+            double dist = (tree[left].num_leaves * cluster_dists[static_cast<size_t>(left) * num_nodes + other]
+                           + tree[right].num_leaves * cluster_dists[static_cast<size_t>(right) * num_nodes + other])
+                          / node.num_leaves;
+            cluster_dists[static_cast<size_t>(merged) * num_nodes + other] = dist;
+            cluster_dists[static_cast<size_t>(other) * num_nodes + merged] = dist;
+        }
+
+        active.erase(active.begin() + best_b);
+        active[best_a] = merged;
+    }
+
+    return tree;
+}
+
+void split_subtrees(const guide_tree_t& tree, int num_subtrees, std::vector<int>& subtrees) {
+    subtrees.clear();
+    subtrees.push_back(tree.size() - 1);
+
+    while (static_cast<int>(subtrees.size()) < num_subtrees) {
+        // Split the largest subtree that is not a leaf
+        int largest = -1;
+        for (size_t k = 0; k < subtrees.size(); k++) {
+            const tree_node_t& node = tree[subtrees[k]];
+            if (node.left != -1 && (largest == -1 || node.num_leaves > tree[subtrees[largest]].num_leaves))
+                largest = k;
+        }
+        if (largest == -1)
+            break;
+
+        const tree_node_t& node = tree[subtrees[largest]];
+        int left = node.left;
+        int right = node.right;
+        subtrees[largest] = left;
+        subtrees.push_back(right);
+    }
+}
+
+// Aligns two alignments of disjoint sets of sequences into one.
+static seq_group_t merge_alnmts(seq_group_t group1, seq_group_t group2, align_params_t& params) {
+    // update_alnmt indexes the new alignment by id, so renumber both groups
+    std::vector<int> seq_ids{};
+    for (seq_t& seq : group1) {
+        seq_ids.push_back(seq.id);
+        seq.id = seq_ids.size() - 1;
+    }
+    for (seq_t& seq : group2) {
+        seq_ids.push_back(seq.id);
+        seq.id = seq_ids.size() - 1;
+    }
+
+    gap_pos_t gap_pos{};
+    align_groups(group1, group2, params, gap_pos);
+    seq_group_t merged = update_alnmt(group1, group2, gap_pos);
+
+    for (seq_t& seq : merged)
+        seq.id = seq_ids[seq.id];
+    return merged;
+}
+
+seq_group_t align_subtree(const std::vector<fasta_rec_t>& fasta_recs, const guide_tree_t& tree, int node, align_params_t& params, std::vector<seq_group_t>& node_alnmts) {
+    if (!node_alnmts[node].empty())
+        return node_alnmts[node];
+
+    const tree_node_t& tree_node = tree[node];
+    if (tree_node.left == -1) {
+        seq_t seq;
+        seq.id = node;
+        seq.data = std::string(fasta_recs[node].seq);
+        node_alnmts[node].push_back(seq);
+        return node_alnmts[node];
+    }
+
+    seq_group_t left = align_subtree(fasta_recs, tree, tree_node.left, params, node_alnmts);
+    seq_group_t right = align_subtree(fasta_recs, tree, tree_node.right, params, node_alnmts);
+    node_alnmts[node] = merge_alnmts(left, right, params);
+
+    // Children are not needed again
+    node_alnmts[tree_node.left].clear();
+    node_alnmts[tree_node.right].clear();
+    return node_alnmts[node];
+}
+
+seq_group_t progressive_alnmt(const std::vector<fasta_rec_t>& fasta_recs, align_params_t& params) {
+    int num_seqs = fasta_recs.size();
+
+    std::vector<double> dists{};
+    kmer_dists(fasta_recs, 0, 1, dists);
+    guide_tree_t tree = upgma_tree(dists, num_seqs);
+
+    std::vector<seq_group_t> node_alnmts(tree.size());
+    seq_group_t alnmt = align_subtree(fasta_recs, tree, tree.size() - 1, params, node_alnmts);
+
+    std::sort(alnmt.begin(), alnmt.end(), [](const seq_t& a, const seq_t& b) { return a.id < b.id; });
+    return alnmt;
+}
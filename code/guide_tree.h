@@ -0,0 +1,69 @@
+/** @file guide_tree.h
+ *  @brief Guide tree construction and progressive alignment, used to build
+ *         the initial alignment for Berger-Munson.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#ifndef __GUIDE_TREE_H__
+#define __GUIDE_TREE_H__
+
+#include "align.h"
+#include "parse_fasta.h"
+
+#include <vector>
+
+/**
+ * Length of the k-mers used for distances between sequences.
+ */
+#define KMER_LEN 3
+
+/**
+ * Node of a rooted binary guide tree. Leaves have left == right == -1.
+ */
+typedef struct tree_node {
+    int left;
+    int right;
+    int num_leaves;
+} tree_node_t;
+
+/**
+ * Guide tree over N sequences. Nodes 0 to N-1 are the leaves (node i is
+ * sequence i), and the root is the last node.
+ */
+typedef std::vector<tree_node_t> guide_tree_t;
+
+/**
+ * Computes k-mer distances between sequences, into an N x N row-major matrix.
+ * Only rows i with i % nproc == pid are computed (entries (i, j) with j > i);
+ * all other entries are left at 0, so the rows of several processors can be
+ * summed together.
+ */
+void kmer_dists(const std::vector<fasta_rec_t>& fasta_recs, int pid, int nproc, std::vector<double>& dists);
+
+/**
+ * Builds a UPGMA guide tree from a distance matrix. Only entries (i, j) with
+ * j > i are read.
+ */
+guide_tree_t upgma_tree(const std::vector<double>& dists, int num_seqs);
+
+/**
+ * Splits the tree into exactly num_subtrees disjoint subtrees (fewer if
+ * there are not enough leaves), by repeatedly splitting the largest one.
+ */
+void split_subtrees(const guide_tree_t& tree, int num_subtrees, std::vector<int>& subtrees);
+
+/**
+ * Progressively aligns the sequences under a node, following the tree.
+ * Alignments of nodes already present in node_alnmts (non-empty entries) are
+ * reused rather than recomputed. Rows keep their sequence ids.
+ */
+seq_group_t align_subtree(const std::vector<fasta_rec_t>& fasta_recs, const guide_tree_t& tree, int node, align_params_t& params, std::vector<seq_group_t>& node_alnmts);
+
+/**
+ * Constructs an initial alignment by progressive alignment along a k-mer
+ * UPGMA guide tree. Sequence i of the result has id i.
+ */
+seq_group_t progressive_alnmt(const std::vector<fasta_rec_t>& fasta_recs, align_params_t& params);
+
+#endif
@@ -0,0 +1,82 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+loop_metrics_t loop_metrics{};
+
+// Implements accept_rates, described in metrics.h
+std::vector<double> accept_rates(const std::string& accept_reject_chain, int window) {
+    std::vector<double> rates{};
+    int len = accept_reject_chain.size();
+    int accepts = 0;
+    for (int i = 0; i < len; i++) {
+        accepts += accept_reject_chain[i] == 'A';
+        if (i >= window)
+            accepts -= accept_reject_chain[i - window] == 'A';
+        if ((i + 1) % window == 0 || i == len - 1)
+            rates.push_back(static_cast<double>(accepts) / std::min(i + 1, window));
+    }
+    return rates;
+}
+
+// Implements metrics_filename, described in metrics.h
+std::string metrics_filename(const std::string& output_filename) {
+    return output_filename + ".metrics.json";
+}
+
+// Writes a vector as a JSON array.
+template <typename T>
+static void write_array(std::ofstream& fout, const std::vector<T>& values) {
+    fout << "[";
+    for (size_t i = 0; i < values.size(); i++)
+        fout << (i > 0 ? ", " : "") << values[i];
+    fout << "]";
+}
+
+// Implements write_metrics, described in metrics.h
+bool write_metrics(const std::string& filename, const metrics_report_t& report) {
+    std::ofstream fout(filename);
+    if (!fout)
+        return false;
+
+    long long cells = 0;
+    long long comm_bytes = 0;
+    std::vector<double> rank_cells_per_sec{};
+    for (size_t r = 0; r < report.rank_cells.size(); r++) {
+        cells += report.rank_cells[r];
+        comm_bytes += report.rank_comm_bytes[r];
+        rank_cells_per_sec.push_back(report.rank_loop_sec[r] > 0.0 ? report.rank_cells[r] / report.rank_loop_sec[r] : 0.0);
+    }
+    double gcups = report.loop_runtime > 0.0 ? cells / report.loop_runtime / 1e9 : 0.0;
+    double discarded_frac = report.candidates > 0 ? static_cast<double>(report.discarded) / report.candidates : 0.0;
+    std::vector<double> rates = accept_rates(report.accept_reject_chain, ACCEPT_RATE_WINDOW);
+    long long num_accepts = std::count(report.accept_reject_chain.begin(), report.accept_reject_chain.end(), 'A');
+
+    fout << "{\n";
+    fout << "  \"program\": \"" << report.program << "\",\n";
+    fout << "  \"nproc\": " << report.rank_cells.size() << ",\n";
+    fout << "  \"iterations\": " << report.num_iters << ",\n";
+    fout << "  \"steps\": " << report.num_steps << ",\n";
+    fout << "  \"score\": " << report.best_score << ",\n";
+    fout << "  \"runtime_sec\": " << report.runtime << ",\n";
+    fout << "  \"loop_runtime_sec\": " << report.loop_runtime << ",\n";
+    fout << "  \"dp\": {\"cells\": " << cells << ", \"gcups\": " << gcups << ", \"rank_cells\": ";
+    write_array(fout, report.rank_cells);
+    fout << ", \"rank_cells_per_sec\": ";
+    write_array(fout, rank_cells_per_sec);
+    fout << "},\n";
+    fout << "  \"speculation\": {\"candidates\": " << report.candidates << ", \"discarded\": " << report.discarded
+         << ", \"discarded_fraction\": " << discarded_frac << "},\n";
+    fout << "  \"accepts\": {\"count\": " << num_accepts << ", \"window\": " << ACCEPT_RATE_WINDOW
+         << ", \"final_rate\": " << (rates.empty() ? 0.0 : rates.back()) << ", \"rates\": ";
+    write_array(fout, rates);
+    fout << "},\n";
+    fout << "  \"comm\": {\"bytes\": " << comm_bytes << ", \"rank_bytes\": ";
+    write_array(fout, report.rank_comm_bytes);
+    fout << "}\n";
+    fout << "}\n";
+    return static_cast<bool>(fout);
+}
@@ -0,0 +1,67 @@
+/** @file metrics.h
+ *  @brief Efficiency metrics of a Berger-Munson run (DP throughput,
+ *         speculation waste, accept rate and communication volume), written
+ *         as JSON next to the text output.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <string>
+#include <vector>
+
+/**
+ * Iterations the accept rate is measured over.
+ */
+#define ACCEPT_RATE_WINDOW 100
+
+/**
+ * Counters of this processor's Berger-Munson loop.
+ */
+typedef struct loop_metrics {
+    long long candidates = 0;  // Candidate iterations evaluated
+    long long discarded = 0;   // Candidates evaluated past the accepted one
+    long long comm_bytes = 0;  // Payload bytes sent or received
+} loop_metrics_t;
+
+extern loop_metrics_t loop_metrics;
+
+/**
+ * Metrics of a whole run. Per-rank vectors are indexed by rank.
+ */
+typedef struct metrics_report {
+    std::string program;
+    int num_iters;
+    int num_steps;
+    int best_score;
+    double runtime;
+    double loop_runtime;
+    long long candidates;
+    long long discarded;
+    std::string accept_reject_chain;
+    std::vector<long long> rank_cells;
+    std::vector<double> rank_loop_sec;
+    std::vector<long long> rank_comm_bytes;
+} metrics_report_t;
+
+/**
+ * Accept rate over the window iterations ending at every multiple of window,
+ * then at the end of the chain.
+ */
+std::vector<double> accept_rates(const std::string& accept_reject_chain, int window);
+
+/**
+ * Name of the metrics file written next to an output file.
+ */
+std::string metrics_filename(const std::string& output_filename);
+
+/**
+ * Writes a run's metrics as JSON.
+ *
+ * @return Whether the file was written.
+ */
+bool write_metrics(const std::string& filename, const metrics_report_t& report);
+
+#endif
@@ -0,0 +1,369 @@
+/** @file micro_bench.cpp
+ *  Microbenchmarks of the alignment and partition hot paths, swept over the
+ *  number of sequences N and their length L. Results are written as JSON,
+ *  and can be compared against a stored baseline.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#include "align.h"
+#include "bm_comm.h"
+#include "bm_utils.h"
+#include "parse_fasta.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+/**
+ * Minimum time each benchmark is repeated for.
+ */
+#define BENCH_MIN_SEC 0.2
+
+/**
+ * Relative change in ns/op reported as a regression or an improvement.
+ */
+#define BENCH_TOLERANCE 0.10
+
+// Heap allocations since program start, counted by the replaced operator new
+static long long num_allocs = 0;
+
+void *operator new(size_t size) {
+    num_allocs++;
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+/**
+ * Result of one benchmark at one size. cells_per_sec is 0 for benchmarks that
+ * do not fill DP cells.
+ */
+typedef struct bench_result {
+    std::string name;
+    int num_seqs;
+    int seq_len;
+    double ns_per_op;
+    double cells_per_sec;
+    double allocs_per_op;
+} bench_result_t;
+
+/**
+ * Synthetic family of N sequences of length about L: mutated copies of a
+ * random root, with 20% substitutions and occasional indels.
+ */
+typedef struct bench_input {
+    std::vector<std::string> names;
+    std::vector<std::string> seqs;
+    std::vector<fasta_rec_t> fasta_recs;
+} bench_input_t;
+
+static void make_input(int num_seqs, int seq_len, bench_input_t& input) {
+    static const char alphabet[] = "ACDEFGHIKLMNPQRSTVWY";
+    std::mt19937 rng(num_seqs * 7919 + seq_len);
+    std::uniform_int_distribution<int> residue(0, 19);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+
+    std::string root{};
+    for (int k = 0; k < seq_len; k++)
+        root += alphabet[residue(rng)];
+
+    input.names.clear();
+    input.seqs.clear();
+    for (int i = 0; i < num_seqs; i++) {
+        std::string seq{};
+        for (char c : root) {
+            double r = coin(rng);
+            if (r < 0.02)
+                continue;
+            seq += r < 0.2 ? alphabet[residue(rng)] : c;
+            if (coin(rng) < 0.02)
+                seq += alphabet[residue(rng)];
+        }
+        if (seq.empty())
+            seq = root;
+        input.names.push_back("seq" + std::to_string(i));
+        input.seqs.push_back(seq);
+    }
+
+    // Records view into the strings, which no longer change
+    input.fasta_recs.clear();
+    for (int i = 0; i < num_seqs; i++)
+        input.fasta_recs.push_back(fasta_rec_t{input.names[i], "", input.seqs[i]});
+}
+
+// Repeats op until BENCH_MIN_SEC has passed, recording ns and allocations per
+// op. cells is the number of DP cells one op fills.
+template <typename Op>
+static bench_result_t run_bench(const std::string& name, int num_seqs, int seq_len, long long cells, Op op) {
+    op(); // Warm up
+
+    long long num_ops = 0;
+    long long allocs_start = num_allocs;
+    const auto start = CLOCK_NOW;
+    double sec = 0.0;
+    do {
+        op();
+        num_ops++;
+        sec = TIME_SEC(start, CLOCK_NOW);
+    } while (sec < BENCH_MIN_SEC);
+
+    bench_result_t result{};
+    result.name = name;
+    result.num_seqs = num_seqs;
+    result.seq_len = seq_len;
+    result.ns_per_op = sec * 1e9 / num_ops;
+    result.cells_per_sec = cells * num_ops / sec;
+    result.allocs_per_op = static_cast<double>(num_allocs - allocs_start) / num_ops;
+    return result;
+}
+
+// Runs every benchmark at one size.
+static void bench_size(int num_seqs, int seq_len, std::vector<bench_result_t>& results) {
+    bench_input_t input{};
+    make_input(num_seqs, seq_len, input);
+    align_params_t params{};
+
+    // A representative partition: the first split of the default family
+    seq_group_t cur_alnmt = naiive_alnmt(input.fasta_recs);
+    partn_family_t family = make_partn_family(PARTN_SMALL, input.fasta_recs);
+    seq_group_t group1{};
+    seq_group_t group2{};
+    build_partn(cur_alnmt, 0, family, group1, group2);
+    seq_group_t full2 = group2;
+    remove_glbl_gaps(group1);
+    remove_glbl_gaps(group2);
+
+    int num_rows = group1[0].data.length() + 1;
+    int num_cols = group2[0].data.length() + 1;
+    long long cells = static_cast<long long>(num_rows) * num_cols;
+
+    matrix_t score(num_rows, std::vector<int>(num_cols, 0));
+    matrix_t backtrack(num_rows, std::vector<int>(num_cols, 0));
+    gap_pos_t gap_pos{};
+    volatile int sink = 0;
+
+    results.push_back(run_bench("forward_pass", num_seqs, seq_len, cells, [&]() {
+        sink = forward_pass(group1, group2, params, score, backtrack);
+    }));
+    results.push_back(run_bench("backward_pass", num_seqs, seq_len, 0, [&]() {
+        gap_pos.clear();
+        backward_pass(backtrack, gap_pos);
+    }));
+    results.push_back(run_bench("align_groups", num_seqs, seq_len, cells, [&]() {
+        sink = align_groups(group1, group2, params, gap_pos);
+    }));
+
+    // Score functions are timed over a whole row of columns, per call
+    int weight1 = group_weight(group1);
+    int weight2 = group_weight(group2);
+    int row = 0;
+    bench_result_t sub = run_bench("sub_score", num_seqs, seq_len, 0, [&]() {
+        int i = row++ % (num_rows - 1);
+        for (int j = 0; j < num_cols - 1; j++)
+            sink = sub_score(group1, group2, i, j, params);
+    });
+    sub.ns_per_op /= num_cols - 1;
+    sub.allocs_per_op /= num_cols - 1;
+    results.push_back(sub);
+    bench_result_t gap = run_bench("gap_score", num_seqs, seq_len, 0, [&]() {
+        for (int j = 0; j < num_cols - 1; j++)
+            sink = gap_score(weight1, group2, j, params) + gap_score(weight2, group1, j % (num_rows - 1), params);
+    });
+    gap.ns_per_op /= 2 * (num_cols - 1);
+    gap.allocs_per_op /= 2 * (num_cols - 1);
+    results.push_back(gap);
+
+    align_groups(group1, group2, params, gap_pos);
+    results.push_back(run_bench("update_alnmt", num_seqs, seq_len, 0, [&]() {
+        seq_group_t new_alnmt = update_alnmt(group1, group2, gap_pos);
+        sink = new_alnmt.size();
+    }));
+
+    // Gaps are removed from a fresh copy each time; the copy is timed
+    // separately and subtracted
+    bench_result_t copy = run_bench("copy", num_seqs, seq_len, 0, [&]() {
+        seq_group_t group = full2;
+        sink = group.size();
+    });
+    bench_result_t remove = run_bench("remove_glbl_gaps", num_seqs, seq_len, 0, [&]() {
+        seq_group_t group = full2;
+        remove_glbl_gaps(group);
+        sink = group.size();
+    });
+    remove.ns_per_op -= copy.ns_per_op;
+    remove.allocs_per_op -= copy.allocs_per_op;
+    results.push_back(remove);
+
+    int glbl_idx = 0;
+    results.push_back(run_bench("select_partn", num_seqs, seq_len, 0, [&]() {
+        seq_group_t sel1{};
+        seq_group_t sel2{};
+        sink = select_partn(cur_alnmt, 0, glbl_idx++, PSEUDORANDOM, family, sel1, sel2);
+    }));
+
+    std::vector<char> bytes{};
+    results.push_back(run_bench("serialize_fasta_recs", num_seqs, seq_len, 0, [&]() {
+        bytes.clear();
+        serialize_fasta_recs(input.fasta_recs, bytes);
+    }));
+    results.push_back(run_bench("deserialize_fasta_recs", num_seqs, seq_len, 0, [&]() {
+        std::vector<fasta_rec_t> recs = deserialize_fasta_recs(bytes.data(), bytes.size());
+        sink = recs.size();
+    }));
+}
+
+// Parses a comma-separated list of sizes.
+static std::vector<int> parse_sizes(const char *arg) {
+    std::vector<int> sizes{};
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        sizes.push_back(atoi(item.c_str()));
+    return sizes;
+}
+
+// Writes results as JSON, one result per line.
+static void write_results(std::ostream& out, const std::vector<bench_result_t>& results) {
+    out << "{\"results\": [\n";
+    for (size_t k = 0; k < results.size(); k++) {
+        const bench_result_t& r = results[k];
+        out << "  {\"name\": \"" << r.name << "\", \"n\": " << r.num_seqs << ", \"l\": " << r.seq_len
+            << ", \"ns_per_op\": " << r.ns_per_op << ", \"cells_per_sec\": " << r.cells_per_sec
+            << ", \"allocs_per_op\": " << r.allocs_per_op << "}" << (k + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]}\n";
+}
+
+// Value of a numeric field in one line of results JSON.
+static double json_field(const std::string& line, const std::string& field) {
+    size_t pos = line.find("\"" + field + "\": ");
+    if (pos == std::string::npos)
+        return 0.0;
+    return atof(line.c_str() + pos + field.size() + 4);
+}
+
+// Reads ns/op by (name, n, l) from results written by write_results.
+static bool read_baseline(const std::string& filename, std::map<std::string, double>& baseline) {
+    std::ifstream fin(filename);
+    if (!fin)
+        return false;
+
+    std::string line;
+    while (std::getline(fin, line)) {
+        size_t pos = line.find("\"name\": \"");
+        if (pos == std::string::npos)
+            continue;
+        pos += 9;
+        std::string name = line.substr(pos, line.find('"', pos) - pos);
+        std::string key = name + " " + std::to_string(static_cast<int>(json_field(line, "n"))) + " " + std::to_string(static_cast<int>(json_field(line, "l")));
+        baseline[key] = json_field(line, "ns_per_op");
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<int> seq_counts = {4, 16, 64};
+    std::vector<int> seq_lens = {100, 400, 1600};
+    std::string output_filename = "";
+    std::string baseline_filename = "";
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:l:o:b:")) != -1) {
+        switch (opt) {
+            case 'n':
+                seq_counts = parse_sizes(optarg);
+                break;
+            case 'l':
+                seq_lens = parse_sizes(optarg);
+                break;
+            case 'o':
+                output_filename = optarg;
+                break;
+            case 'b':
+                baseline_filename = optarg;
+                break;
+        default:
+            std::cerr << "Usage: " << argv[0] << " [-n N1,N2,...] [-l L1,L2,...] [-o output_filename] [-b baseline_filename]\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    std::vector<bench_result_t> results{};
+    for (int num_seqs : seq_counts) {
+        for (int seq_len : seq_lens) {
+            if (num_seqs < 2 || seq_len < 1) {
+                std::cerr << "Sizes must have N >= 2 and L >= 1.\n";
+                exit(EXIT_FAILURE);
+            }
+            std::cerr << "Running N = " << num_seqs << ", L = " << seq_len << "\n";
+            bench_size(num_seqs, seq_len, results);
+        }
+    }
+
+    if (output_filename.empty()) {
+        write_results(std::cout, results);
+    } else {
+        std::ofstream fout(output_filename);
+        write_results(fout, results);
+    }
+
+    if (baseline_filename.empty())
+        return 0;
+
+    std::map<std::string, double> baseline{};
+    if (!read_baseline(baseline_filename, baseline)) {
+        std::cerr << "Unable to open baseline: " << baseline_filename << ".\n";
+        exit(EXIT_FAILURE);
+    }
+
+    // Ratio of each result to its baseline; above 1 is slower
+    int num_slower = 0;
+    std::cerr << "Compared with " << baseline_filename << ":\n";
+    for (const bench_result_t& r : results) {
+        auto found = baseline.find(r.name + " " + std::to_string(r.num_seqs) + " " + std::to_string(r.seq_len));
+        if (found == baseline.end() || found->second <= 0.0)
+            continue;
+        double ratio = r.ns_per_op / found->second;
+        const char *verdict = "";
+        if (ratio > 1.0 + BENCH_TOLERANCE) {
+            verdict = "  slower";
+            num_slower++;
+        } else if (ratio < 1.0 - BENCH_TOLERANCE) {
+            verdict = "  faster";
+        }
+        std::cerr << "  " << r.name << " N = " << r.num_seqs << " L = " << r.seq_len << ": " << r.ns_per_op << " ns/op, "
+                  << ratio << "x baseline" << verdict << "\n";
+    }
+    std::cerr << num_slower << " slower than baseline by more than " << 100 * BENCH_TOLERANCE << "%.\n";
+}
@@ -5,11 +5,20 @@
 
 #include <parse_fasta.h>
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 std::vector<fasta_seq_t> parse_fasta(std::string filename) {
@@ -29,7 +38,7 @@ std::vector<fasta_seq_t> parse_fasta(std::string filename) {
     while (std::getline(fin, input_line)) {
         if (input_line[0] == '>') {
             if (seen_first_seq) {
-                seqs.push_back(cur_seq);
+                seqs.push_back(std::move(cur_seq));
             } else {
                 seen_first_seq = true;
             }
@@ -47,12 +56,132 @@ std::vector<fasta_seq_t> parse_fasta(std::string filename) {
             cur_seq.seq.append(input_line);
         }
     }
-    seqs.push_back(cur_seq); // flush last seq
+    seqs.push_back(std::move(cur_seq)); // flush last seq
 
     return seqs;
 }
 
-void print_fasta_seq(fasta_seq_t seq) {
+char *next_fasta_rec(char *data, char *pos, char *end) {
+    if (pos < end && *pos == '>' && (pos == data || pos[-1] == '\n'))
+        return pos;
+    while (pos < end) {
+        char *newline = static_cast<char *>(memchr(pos, '\n', end - pos));
+        if (newline == NULL || newline + 1 >= end)
+            return end;
+        if (newline[1] == '>')
+            return newline + 1;
+        pos = newline + 1;
+    }
+    return end;
+}
+
+void parse_fasta_chunk(char *begin, char *end, std::vector<fasta_rec_t>& recs) {
+    char *pos = begin;
+    while (pos < end) {
+        char *rec_end = next_fasta_rec(begin, pos + 1, end);
+
+        // Header line
+        char *line_end = static_cast<char *>(memchr(pos, '\n', rec_end - pos));
+        if (line_end == NULL)
+            line_end = rec_end;
+        char *header_end = line_end;
+        if (header_end > pos + 1 && header_end[-1] == '\r')
+            header_end--;
+        std::string_view header(pos + 1, header_end - (pos + 1));
+
+        fasta_rec_t rec;
+        size_t space_pos = header.find(' ');
+        if (space_pos != std::string_view::npos) {
+            rec.ident = header.substr(0, space_pos);
+            rec.desc = header.substr(space_pos);
+        } else {
+            rec.ident = header;
+            rec.desc = std::string_view();
+        }
+
+        // Compact the sequence lines in place, moving one line at a time
+        char *seq_start = line_end < rec_end ? line_end + 1 : rec_end;
+        char *write = seq_start;
+        char *read = seq_start;
+        while (read < rec_end) {
+            char *newline = static_cast<char *>(memchr(read, '\n', rec_end - read));
+            char *seg_end = newline == NULL ? rec_end : newline;
+            char *next = newline == NULL ? rec_end : newline + 1;
+            if (seg_end > read && seg_end[-1] == '\r')
+                seg_end--;
+            size_t seg_len = seg_end - read;
+            if (write != read)
+                memmove(write, read, seg_len);
+            write += seg_len;
+            read = next;
+        }
+        rec.seq = std::string_view(seq_start, write - seq_start);
+
+        recs.push_back(rec);
+        pos = rec_end;
+    }
+}
+
+void map_fasta(const std::string& filename, int num_threads, fasta_map_t& fasta_map) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) < 0) {
+        std::cerr << "Unable to open file: " << filename << ".\n";
+        exit(EXIT_FAILURE);
+    }
+
+    fasta_map.size = file_stat.st_size;
+    fasta_map.data = NULL;
+    fasta_map.recs.clear();
+    if (fasta_map.size == 0) {
+        close(fd);
+        return;
+    }
+
+    // Private and writable, so sequences can be compacted in place
+    void *addr = mmap(NULL, fasta_map.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Unable to map file: " << filename << ".\n";
+        exit(EXIT_FAILURE);
+    }
+    madvise(addr, fasta_map.size, MADV_SEQUENTIAL);
+    fasta_map.data = static_cast<char *>(addr);
+
+    char *data = fasta_map.data;
+    char *file_end = data + fasta_map.size;
+    if (num_threads < 1)
+        num_threads = 1;
+
+    // Split into chunks of roughly equal size, moved forward to record
+    // boundaries. Anything before the first record is skipped.
+    std::vector<char *> bounds(num_threads + 1);
+    bounds[0] = next_fasta_rec(data, data, file_end);
+    for (int t = 1; t < num_threads; t++)
+        bounds[t] = std::max(bounds[t-1], next_fasta_rec(data, data + (fasta_map.size * t) / num_threads, file_end));
+    bounds[num_threads] = file_end;
+
+    std::vector<std::vector<fasta_rec_t>> chunk_recs(num_threads);
+    std::vector<std::thread> threads{};
+    for (int t = 1; t < num_threads; t++)
+        threads.emplace_back(parse_fasta_chunk, bounds[t], bounds[t+1], std::ref(chunk_recs[t]));
+    parse_fasta_chunk(bounds[0], bounds[1], chunk_recs[0]);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (std::vector<fasta_rec_t>& recs : chunk_recs)
+        fasta_map.recs.insert(fasta_map.recs.end(), recs.begin(), recs.end());
+}
+
+void unmap_fasta(fasta_map_t& fasta_map) {
+    if (fasta_map.data != NULL)
+        munmap(fasta_map.data, fasta_map.size);
+    fasta_map.data = NULL;
+    fasta_map.size = 0;
+    fasta_map.recs.clear();
+}
+
+void print_fasta_seq(const fasta_seq_t& seq) {
     std::cout << "FASTA sequence ID: " << seq.ident << "\n";
     std::cout << "Description: " << seq.desc << "\n";
     std::cout << "Sequence: " << seq.seq << "\n";
@@ -7,7 +7,9 @@
 #ifndef __PARSE_FASTA_H__
 #define __PARSE_FASTA_H__
 
+#include <cstddef>
 #include <string>
+#include <string_view>
 #include <vector>
 
 /**
@@ -21,14 +23,67 @@ typedef struct fasta_seq {
 } fasta_seq_t;
 
 
+/**
+ * Represents a FASTA record without owning its data. The fields view into
+ * the buffer the record was parsed from (a mapped file, a received message,
+ * or a fasta_seq_t), and are only valid while it is.
+ */
+typedef struct fasta_rec {
+    std::string_view ident;
+    std::string_view desc;
+    std::string_view seq;
+} fasta_rec_t;
+
+/**
+ * Represents a FASTA file mapped into memory, and the records parsed from
+ * it. The mapping is private, so compacting sequences in place does not
+ * modify the file.
+ */
+typedef struct fasta_map {
+    char *data = NULL;
+    size_t size = 0;
+    std::vector<fasta_rec_t> recs;
+} fasta_map_t;
+
 /**
  * Parses a FASTA file into memory.
  */
 std::vector<fasta_seq_t> parse_fasta(std::string filename);
 
+/**
+ * Maps a FASTA file into memory and parses it with num_threads threads, each
+ * taking a chunk of whole records. Line breaks inside each sequence are
+ * removed in place, once, so every record's sequence is contiguous.
+ * Produces the same records as parse_fasta, except that trailing '\r's are
+ * also removed.
+ */
+void map_fasta(const std::string& filename, int num_threads, fasta_map_t& fasta_map);
+
+/**
+ * Finds the start of the first record at or after pos, in a buffer of FASTA
+ * text beginning at data. A record starts with a '>' at the beginning of a
+ * line; a '>' at data itself counts as one.
+ *
+ * @return The start of the record, or end if there is none before end.
+ */
+char *next_fasta_rec(char *data, char *pos, char *end);
+
+/**
+ * Parses the records in [begin, end) into recs, compacting sequence lines in
+ * place. begin must be the start of a record, and end the start of a record
+ * or the end of the text. Only that range is read or written, so disjoint
+ * chunks can be parsed concurrently.
+ */
+void parse_fasta_chunk(char *begin, char *end, std::vector<fasta_rec_t>& recs);
+
+/**
+ * Unmaps a file mapped by map_fasta. Its records are no longer valid.
+ */
+void unmap_fasta(fasta_map_t& fasta_map);
+
 /**
  * Prints a FASTA seq's data to std::cout.
  */
-void print_fasta_seq(fasta_seq_t seq);
+void print_fasta_seq(const fasta_seq_t& seq);
 
 #endif
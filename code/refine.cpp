@@ -0,0 +1,132 @@
+#include "refine.h"
+#include "align.h"
+#include "bm_utils.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Implements init_refine, described in refine.h
+void init_refine(refine_state_t& state, int alnmt_len) {
+    state.col_stamp.assign(alnmt_len, 0);
+}
+
+// Implements refine_window, described in refine.h
+bool refine_window(const refine_state_t& state, int glbl_idx, int& start, int& end) {
+    int alnmt_len = state.col_stamp.size();
+    if (glbl_idx % REFINE_FULL_EVERY == 0)
+        return false;
+
+    // Regions of recently changed columns, merged where their flanks overlap
+    std::vector<std::pair<int, int>> regions{};
+    for (int c = 0; c < alnmt_len; c++) {
+        if (state.col_stamp[c] <= glbl_idx - REFINE_AGE)
+            continue;
+        int lo = std::max(0, c - REFINE_FLANK);
+        int hi = std::min(alnmt_len, c + 1 + REFINE_FLANK);
+        if (!regions.empty() && lo <= regions.back().second)
+            regions.back().second = hi;
+        else
+            regions.push_back({lo, hi});
+    }
+    if (regions.empty())
+        return false;
+
+    // Successive iterations take turns over the regions
+    const std::pair<int, int>& region = regions[glbl_idx % regions.size()];
+    if (2 * (region.second - region.first) >= alnmt_len)
+        return false;
+
+    start = region.first;
+    end = region.second;
+    return true;
+}
+
+// Length of a group once its global gaps are removed.
+static int ungapped_len(const seq_group_t& group) {
+    int len = 0;
+    for (size_t c = 0; c < group[0].data.size(); c++) {
+        for (const seq_t& seq : group) {
+            if (seq.data[c] != '-') {
+                len++;
+                break;
+            }
+        }
+    }
+    return len;
+}
+
+// Implements window_gap_pos, described in refine.h
+gap_pos_t window_gap_pos(const seq_group_t& group1, const seq_group_t& group2, int start, int end) {
+    seq_group_t window1 = slice_group(group1, start, end);
+    seq_group_t window2 = slice_group(group2, start, end);
+    return current_gap_pos(window1, window2);
+}
+
+// Implements align_window, described in refine.h
+int align_window(seq_group_t& group1, seq_group_t& group2, int start, int end, int cur_score, align_params_t& params,
+                 gap_pos_t& old_path, gap_pos_t& gap_pos) {
+    seq_group_t window1 = slice_group(group1, start, end);
+    seq_group_t window2 = slice_group(group2, start, end);
+    old_path = current_gap_pos(window1, window2);
+
+    // The flanks keep their score; only the window's changes
+    seq_group_t window = window1;
+    window.insert(window.end(), window2.begin(), window2.end());
+    int old_score = alnmt_score(window, params);
+
+    // The window counts its own cells; the full matrix is what a full pass
+    // would have computed
+    long long full_cells = dp_stats.full_cells;
+    remove_glbl_gaps(window1);
+    remove_glbl_gaps(window2);
+    int new_score = align_groups(window1, window2, params, gap_pos);
+    dp_stats.full_cells = full_cells + static_cast<long long>(ungapped_len(group1) + 1) * (ungapped_len(group2) + 1);
+    return cur_score - old_score + new_score;
+}
+
+// Implements update_alnmt_window, described in refine.h
+seq_group_t update_alnmt_window(seq_group_t& group1, seq_group_t& group2, int start, int end, gap_pos_t& gap_pos) {
+    seq_group_t window1 = slice_group(group1, start, end);
+    seq_group_t window2 = slice_group(group2, start, end);
+    remove_glbl_gaps(window1);
+    remove_glbl_gaps(window2);
+    seq_group_t new_alnmt = update_alnmt(window1, window2, gap_pos);
+
+    for (seq_group_t *group : {&group1, &group2}) {
+        for (seq_t& seq : *group) {
+            std::string& data = new_alnmt[seq.id].data;
+            data = seq.data.substr(0, start) + data + seq.data.substr(end);
+        }
+    }
+    return new_alnmt;
+}
+
+// Implements update_stamps, described in refine.h
+void update_stamps(refine_state_t& state, const gap_pos_t& old_path, const gap_pos_t& gap_pos, int start, int end, int glbl_idx) {
+    // Old columns by the cell their move ends at, and the move
+    std::unordered_map<long long, int> old_cols{};
+    long long i = 0;
+    long long j = 0;
+    for (size_t c = 0; c < old_path.size(); c++) {
+        i += !old_path[c].group1_gap;
+        j += !old_path[c].group2_gap;
+        long long move = old_path[c].group1_gap ? 1 : (old_path[c].group2_gap ? 2 : 0);
+        old_cols[((i << 24) ^ j) * 3 + move] = c;
+    }
+
+    std::vector<int> stamps(state.col_stamp.begin(), state.col_stamp.begin() + start);
+    i = 0;
+    j = 0;
+    for (size_t c = 0; c < gap_pos.size(); c++) {
+        i += !gap_pos[c].group1_gap;
+        j += !gap_pos[c].group2_gap;
+        long long move = gap_pos[c].group1_gap ? 1 : (gap_pos[c].group2_gap ? 2 : 0);
+        auto found = old_cols.find(((i << 24) ^ j) * 3 + move);
+        stamps.push_back(found == old_cols.end() ? glbl_idx : state.col_stamp[start + found->second]);
+    }
+    stamps.insert(stamps.end(), state.col_stamp.begin() + end, state.col_stamp.end());
+    state.col_stamp = std::move(stamps);
+}
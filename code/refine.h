@@ -0,0 +1,86 @@
+/** @file refine.h
+ *  @brief Windowed refinement: realigning partitions only around columns
+ *         that changed recently.
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#ifndef __REFINE_H__
+#define __REFINE_H__
+
+#include "align.h"
+
+#include <vector>
+
+/**
+ * Iterations a changed column stays recent.
+ */
+#define REFINE_AGE 20
+
+/**
+ * Unchanged columns realigned on either side of the recently changed ones.
+ */
+#define REFINE_FLANK 16
+
+/**
+ * Every REFINE_FULL_EVERY-th iteration realigns the full length.
+ */
+#define REFINE_FULL_EVERY 10
+
+/**
+ * Represents the iteration at which each column of the current alignment was
+ * last changed by an accept.
+ */
+typedef struct refine_state {
+    std::vector<int> col_stamp;
+} refine_state_t;
+
+/**
+ * Starts tracking an alignment of alnmt_len columns, all changed at
+ * iteration 0.
+ */
+void init_refine(refine_state_t& state, int alnmt_len);
+
+/**
+ * Chooses the columns [start, end) iteration glbl_idx realigns: one region of
+ * columns changed within the last REFINE_AGE iterations, with REFINE_FLANK
+ * columns either side. Successive iterations take turns over the regions.
+ *
+ * @return false if the iteration should realign the full length instead:
+ *         every REFINE_FULL_EVERY-th iteration, when no column changed
+ *         recently, or when the region would cover half the alignment.
+ */
+bool refine_window(const refine_state_t& state, int glbl_idx, int& start, int& end);
+
+/**
+ * Like current_gap_pos, for columns [start, end) of the groups only.
+ */
+gap_pos_t window_gap_pos(const seq_group_t& group1, const seq_group_t& group2, int start, int end);
+
+/**
+ * Aligns group1 against group2 within columns [start, end) of the current
+ * alignment only, keeping the flanking columns fixed. The groups must
+ * partition the current alignment, still with their global gaps, and
+ * cur_score must be its score.
+ *
+ * @param old_path Set to the current path of the groups within the window.
+ * @param gap_pos Set to the new gap positions within the window.
+ * @return Score of the whole resulting alignment.
+ */
+int align_window(seq_group_t& group1, seq_group_t& group2, int start, int end, int cur_score, align_params_t& params,
+                 gap_pos_t& old_path, gap_pos_t& gap_pos);
+
+/**
+ * Like update_alnmt, for gap positions found by align_window.
+ */
+seq_group_t update_alnmt_window(seq_group_t& group1, seq_group_t& group2, int start, int end, gap_pos_t& gap_pos);
+
+/**
+ * Updates the change stamps after an accept at iteration glbl_idx replaced
+ * columns [start, end) of the alignment, whose path was old_path, with the
+ * columns of gap_pos. Columns whose cell and move are on the old path keep
+ * their stamp.
+ */
+void update_stamps(refine_state_t& state, const gap_pos_t& old_path, const gap_pos_t& gap_pos, int start, int end, int glbl_idx);
+
+#endif
@@ -0,0 +1,74 @@
+#!/bin/bash
+#
+# Strong- and weak-scaling sweeps of bm_par on synthetic families from
+# gen_msa, collected into one CSV report.
+#
+# Strong scaling aligns one family of BASE_N sequences at every processor
+# count; weak scaling grows the family to BASE_N * p sequences on p
+# processors. -s and -d set gen_msa's substitution and indel rates, which
+# control how divergent the family is. Set MPIRUN to pass extra flags to
+# mpirun.
+
+NPROCS="1 2 4 8"
+BASE_N=16
+SEQ_LEN=300
+SUB_RATE=0.1
+INDEL_RATE=0.01
+SEED=1
+REPORT="../data/output/scaling.csv"
+MPIRUN=${MPIRUN:-mpirun}
+
+usage() {
+    echo "Usage: $0 [-p \"1 2 4 8\"] [-n base_num_seqs] [-l seq_len] [-s sub_rate] [-d indel_rate] [-r seed] [-o report.csv]" >&2
+    exit 1
+}
+
+while getopts "p:n:l:s:d:r:o:" opt; do
+    case $opt in
+        p) NPROCS=$OPTARG ;;
+        n) BASE_N=$OPTARG ;;
+        l) SEQ_LEN=$OPTARG ;;
+        s) SUB_RATE=$OPTARG ;;
+        d) INDEL_RATE=$OPTARG ;;
+        r) SEED=$OPTARG ;;
+        o) REPORT=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+
+make bm_par gen_msa > /dev/null || exit 1
+
+work_dir="../data/output/scaling"
+mkdir -p "$work_dir" "$(dirname "$REPORT")"
+
+# Value after "label: " in a bm_par log
+field() {
+    grep -m 1 "^$2" "$1" | sed 's/.*: //'
+}
+
+echo "mode,np,num_seqs,seq_len,sub_rate,indel_rate,runtime_sec,parallel_steps,iterations,score,first_iter_sec,bcast_1_sec,bcast_2_sec,allreduce_sec,par_alg_ovhd_sec" > "$REPORT"
+
+for mode in strong weak; do
+    for np in $NPROCS; do
+        num_seqs=$BASE_N
+        if [ "$mode" = "weak" ]; then
+            num_seqs=$((BASE_N * np))
+        fi
+
+        input="${work_dir}/syn_n${num_seqs}_l${SEQ_LEN}_s${SUB_RATE}_d${INDEL_RATE}_r${SEED}.tfa"
+        output="${work_dir}/${mode}_np${np}.out"
+        log="${work_dir}/${mode}_np${np}.log"
+        if [ ! -f "$input" ]; then
+            ./gen_msa -o "$input" -n "$num_seqs" -l "$SEQ_LEN" -s "$SUB_RATE" -d "$INDEL_RATE" -r "$SEED" || exit 1
+        fi
+
+        echo "Running bm_par (${mode}, p=${np}, N=${num_seqs}, L=${SEQ_LEN}, s=${SUB_RATE}, d=${INDEL_RATE})"
+        $MPIRUN -np "$np" ./bm_par -i "$input" -o "$output" -r P > "$log" || exit 1
+
+        iterations=$(grep -m 1 "^Ran for" "$log" | awk '{print $3}')
+        steps=$(grep -m 1 "^Took" "$log" | awk '{print $2}')
+        echo "${mode},${np},${num_seqs},${SEQ_LEN},${SUB_RATE},${INDEL_RATE},$(field "$log" "Runtime (sec)"),${steps},${iterations},$(field "$log" "Alignment score"),$(field "$log" "Time to first iteration"),$(field "$log" "Time in Bcast 1"),$(field "$log" "Time in Bcast 2"),$(field "$log" "Time in Allreduce"),$(field "$log" "Time in par alg overhead")" >> "$REPORT"
+    done
+done
+
+echo "Report: $REPORT"
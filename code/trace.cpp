@@ -0,0 +1,75 @@
+#include "trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+trace_buf_t trace_buf{};
+
+// Implements trace_clock, described in trace.h
+long long trace_clock() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Implements enable_trace, described in trace.h
+void enable_trace() {
+    trace_buf.enabled = true;
+    trace_buf.events.assign(TRACE_CAPACITY, trace_event_t{});
+    trace_buf.num_recorded = 0;
+    trace_buf.origin_ns = trace_clock();
+}
+
+// Implements trace_record, described in trace.h
+void trace_record(int phase, long long begin_ns) {
+    trace_event_t& event = trace_buf.events[trace_buf.num_recorded % TRACE_CAPACITY];
+    event.phase = phase;
+    event.step = trace_buf.step;
+    event.begin_ns = begin_ns - trace_buf.origin_ns;
+    event.end_ns = trace_clock() - trace_buf.origin_ns;
+    trace_buf.num_recorded++;
+}
+
+// Implements trace_events, described in trace.h
+std::vector<trace_event_t> trace_events() {
+    std::vector<trace_event_t> events{};
+    long long first = trace_buf.num_recorded > TRACE_CAPACITY ? trace_buf.num_recorded - TRACE_CAPACITY : 0;
+    for (long long k = first; k < trace_buf.num_recorded; k++)
+        events.push_back(trace_buf.events[k % TRACE_CAPACITY]);
+    return events;
+}
+
+// Implements trace_phase_name, described in trace.h
+const char *trace_phase_name(int phase) {
+    static const char *names[TRACE_NUM_PHASES] = {"partition", "remove gaps", "forward pass", "traceback",
+                                                  "allreduce", "bcast", "update", "exchange"};
+    if (phase < 0 || phase >= TRACE_NUM_PHASES)
+        return "unknown";
+    return names[phase];
+}
+
+// Implements write_chrome_trace, described in trace.h
+bool write_chrome_trace(const std::string& filename, const std::vector<std::vector<trace_event_t>>& rank_events) {
+    std::ofstream fout(filename);
+    if (!fout)
+        return false;
+
+    // Complete ("X") events, with times in microseconds
+    fout << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (size_t rank = 0; rank < rank_events.size(); rank++) {
+        if (!first)
+            fout << ",\n";
+        first = false;
+        fout << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << rank
+             << ", \"args\": {\"name\": \"rank " << rank << "\"}}";
+
+        for (const trace_event_t& event : rank_events[rank]) {
+            fout << ",\n{\"name\": \"" << trace_phase_name(event.phase) << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << rank
+                 << ", \"ts\": " << event.begin_ns / 1000.0 << ", \"dur\": " << (event.end_ns - event.begin_ns) / 1000.0
+                 << ", \"args\": {\"step\": " << event.step << "}}";
+        }
+    }
+    fout << "\n]}\n";
+    return static_cast<bool>(fout);
+}
@@ -0,0 +1,100 @@
+/** @file trace.h
+ *  @brief Low-overhead per-rank tracing of the phases of each step, exported
+ *         as a Chrome trace (viewable in chrome://tracing or Perfetto).
+ *  @author Leon Xie (leonx)
+ *  @author Taekseung Kim (taekseuk)
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <string>
+#include <vector>
+
+/**
+ * Events kept per processor; older events are overwritten once it is full.
+ */
+#define TRACE_CAPACITY (1 << 16)
+
+/**
+ * Traced phases.
+ */
+#define TRACE_PARTN 0       // Selecting or rebuilding a partition
+#define TRACE_REMOVE_GAPS 1 // Removing global gaps
+#define TRACE_FORWARD 2     // DP forward pass
+#define TRACE_BACKWARD 3    // DP traceback
+#define TRACE_ALLREDUCE 4   // Agreeing on the accepting team
+#define TRACE_BCAST 5       // Broadcasting an accepted alignment
+#define TRACE_UPDATE 6      // Updating the current alignment
+#define TRACE_EXCHANGE 7    // Exchange between islands
+#define TRACE_NUM_PHASES 8
+
+/**
+ * A traced phase of one step. Times are in nanoseconds since the trace
+ * origin.
+ */
+typedef struct trace_event {
+    int phase;
+    int step;
+    long long begin_ns;
+    long long end_ns;
+} trace_event_t;
+
+/**
+ * Ring buffer of this processor's events. Empty unless tracing is enabled.
+ */
+typedef struct trace_buf {
+    bool enabled = false;
+    int step = 0;             // Step events are recorded under
+    long long origin_ns = 0;  // Clock reading events are relative to
+    std::vector<trace_event_t> events;
+    long long num_recorded = 0;
+} trace_buf_t;
+
+extern trace_buf_t trace_buf;
+
+/**
+ * Reads the trace clock (nanoseconds, steady).
+ */
+long long trace_clock();
+
+/**
+ * Starts a phase. Only reads the clock if tracing is enabled.
+ */
+#define TRACE_START(var) long long var = trace_buf.enabled ? trace_clock() : 0
+
+/**
+ * Ends a phase started by TRACE_START(var), recording it under the current
+ * step.
+ */
+#define TRACE_END(phase, var) do { if (trace_buf.enabled) trace_record(phase, var); } while (0)
+
+/**
+ * Enables tracing, allocating the ring buffer. Times are measured from now.
+ */
+void enable_trace();
+
+/**
+ * Records a phase that began at begin_ns (a trace_clock reading) and ends now.
+ */
+void trace_record(int phase, long long begin_ns);
+
+/**
+ * This processor's events, oldest first.
+ */
+std::vector<trace_event_t> trace_events();
+
+/**
+ * Name of a traced phase.
+ */
+const char *trace_phase_name(int phase);
+
+/**
+ * Writes every processor's events (indexed by rank) as Chrome trace JSON,
+ * with one thread per rank.
+ *
+ * @return Whether the file was written.
+ */
+bool write_chrome_trace(const std::string& filename, const std::vector<std::vector<trace_event_t>>& rank_events);
+
+#endif